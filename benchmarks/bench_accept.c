@@ -0,0 +1,189 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "apix.h"
+#include "apix-posix.h"
+#include "log.h"
+#include "posix/apix-group.h"
+#include "srrp.h"
+
+#define NR_CONNS 2000
+#define NR_CLIENTS 4
+#define NR_SHARDS 4
+#define BASE_PORT 1330
+
+/*
+ * A reconnect storm: every client thread opens its share of connections
+ * at once, sends a request to a missing station on each, and waits for
+ * the bus to answer. The time until all are answered covers the accept
+ * of the whole storm, a connection dropped by a full backlog costs a
+ * syn retransmit.
+ */
+
+struct client {
+    int port;
+    int nconns;
+    double worst; // slowest connect to answer
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *client_thread(void *arg)
+{
+    struct client *c = arg;
+    struct pollfd *pfds = calloc(c->nconns, sizeof(*pfds));
+    double *begin = calloc(c->nconns, sizeof(*begin));
+    int *sent = calloc(c->nconns, sizeof(*sent));
+    struct srrp_packet *pac = srrp_write_request(1, "/9999/storm", "{}");
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = PF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(c->port);
+
+    for (int i = 0; i < c->nconns; i++) {
+        int fd = socket(PF_INET, SOCK_STREAM, 0);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        begin[i] = now();
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 &&
+            errno != EINPROGRESS)
+            perror("connect");
+        pfds[i].fd = fd;
+        pfds[i].events = POLLOUT;
+    }
+
+    int left = c->nconns;
+    while (left) {
+        if (poll(pfds, c->nconns, 5000) <= 0)
+            break;
+        for (int i = 0; i < c->nconns; i++) {
+            if (pfds[i].fd < 0 || pfds[i].revents == 0)
+                continue;
+            if (!sent[i] && (pfds[i].revents & POLLOUT)) {
+                sent[i] = send(pfds[i].fd, pac->raw, pac->len, 0) == pac->len;
+                pfds[i].events = POLLIN;
+            } else if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                char buf[64];
+                if (recv(pfds[i].fd, buf, sizeof(buf), 0) > 0) {
+                    double elapsed = now() - begin[i];
+                    if (elapsed > c->worst)
+                        c->worst = elapsed;
+                }
+                close(pfds[i].fd);
+                pfds[i].fd = -1;
+                left--;
+            }
+        }
+    }
+
+    for (int i = 0; i < c->nconns; i++) {
+        if (pfds[i].fd >= 0)
+            close(pfds[i].fd);
+    }
+    srrp_free(pac);
+    free(sent);
+    free(begin);
+    free(pfds);
+    return NULL;
+}
+
+static void storm(const char *mode, int port, int nconns, double *total, double *worst)
+{
+    struct client clients[NR_CLIENTS];
+    pthread_t pids[NR_CLIENTS];
+
+    double begin = now();
+    for (int i = 0; i < NR_CLIENTS; i++) {
+        clients[i].port = port;
+        clients[i].nconns = nconns / NR_CLIENTS;
+        clients[i].worst = 0;
+        pthread_create(&pids[i], NULL, client_thread, &clients[i]);
+    }
+    *worst = 0;
+    for (int i = 0; i < NR_CLIENTS; i++) {
+        pthread_join(pids[i], NULL);
+        if (clients[i].worst > *worst)
+            *worst = clients[i].worst;
+    }
+    *total = now() - begin;
+
+    printf("%-22s %8d %10.3f %12.0f %10.3f\n", mode, nconns / NR_CLIENTS * NR_CLIENTS,
+           *total, nconns / *total, *worst);
+}
+
+/*
+ * backlog 0: SOMAXCONN, reuseport 0: shard 0 listens and hands the fds
+ * it accepts to the other shards.
+ */
+static void bench_group(const char *mode, int nshards, int backlog,
+                        int reuseport, int port, int nconns)
+{
+    char addr[32];
+    snprintf(addr, sizeof(addr), "127.0.0.1:%d", port);
+
+    struct apibus_group *group = apibus_group_new(nshards);
+    for (int i = 0; i < nshards; i++)
+        apibus_enable_posix(apibus_group_shard(group, i));
+
+    int fds[NR_SHARDS];
+    if (reuseport) {
+        apibus_group_open_tcp(group, addr, backlog, fds);
+    } else {
+        for (int i = 0; i < nshards; i++)
+            fds[i] = -1;
+        fds[0] = apibus_open_tcp(apibus_group_shard(group, 0), addr);
+        if (backlog)
+            apibus_ioctl(apibus_group_shard(group, 0), fds[0],
+                         APISINK_IOCTL_BACKLOG, backlog);
+    }
+
+    apibus_group_start(group);
+    double total, worst;
+    storm(mode, port, nconns, &total, &worst);
+    // let the shards see the clients go away
+    usleep(200 * 1000);
+    apibus_group_stop(group);
+
+    for (int i = 0; i < nshards; i++) {
+        struct apibus *bus = apibus_group_shard(group, i);
+        if (fds[i] != -1)
+            apibus_close(bus, fds[i]);
+        apibus_disable_posix(bus);
+    }
+    apibus_group_destroy(group);
+}
+
+int main(int argc, char *argv[])
+{
+    int nconns = argc > 1 ? atoi(argv[1]) : NR_CONNS;
+    log_set_level(LOG_LV_ERROR);
+
+    // both ends of every connection live in this process
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if ((rlim_t)nconns * 2 + 64 > rl.rlim_cur)
+        nconns = (rl.rlim_cur - 64) / 2;
+
+    printf("%-22s %8s %10s %12s %10s\n",
+           "mode", "conns", "total s", "conns/s", "worst s");
+    bench_group("1 shard, backlog 100", 1, 100, 0, BASE_PORT, nconns);
+    bench_group("1 shard, somaxconn", 1, 0, 0, BASE_PORT + 1, nconns);
+    bench_group("4 shards, handoff", NR_SHARDS, 0, 0, BASE_PORT + 2, nconns);
+    bench_group("4 shards, reuseport", NR_SHARDS, 0, 1, BASE_PORT + 3, nconns);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "crc16.h"
+
+#define NR_ROUNDS 2000
+
+static const size_t sizes[] = { 16, 64, 256, 1024, 4096 };
+
+/*
+ * The byte-at-a-time table loop crc16_crc replaced, kept as the baseline.
+ */
+static uint16_t legacy_crc16(const char *buf, int len)
+{
+    static uint16_t tab[256];
+    if (tab[1] == 0) {
+        for (int i = 0; i < 256; i++) {
+            uint16_t crc = i << 8;
+            for (int bit = 0; bit < 8; bit++)
+                crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+            tab[i] = crc;
+        }
+    }
+
+    uint16_t crc = 0;
+    for (int counter = 0; counter < len; counter++)
+        crc = (crc<<8) ^ tab[((crc>>8) ^ *buf++)&0x00FF];
+    return crc;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+    char *buf = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+    for (size_t i = 0; i < sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]; i++)
+        buf[i] = rand();
+
+    printf("%8s %12s %12s\n", "bytes", "legacy MB/s", "slice8 MB/s");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        int len = sizes[i];
+        int rounds = NR_ROUNDS * (4096 / len);
+        volatile uint16_t sink = 0;
+
+        double begin = now();
+        for (int round = 0; round < rounds; round++)
+            sink ^= legacy_crc16(buf, len);
+        double legacy = now() - begin;
+
+        begin = now();
+        for (int round = 0; round < rounds; round++)
+            sink ^= crc16(buf, len);
+        double slice = now() - begin;
+
+        if (legacy_crc16(buf, len) != crc16(buf, len)) {
+            printf("mismatch at %d bytes\n", len);
+            return 1;
+        }
+
+        double mb = (double)len * rounds / 1e6;
+        printf("%8d %12.1f %12.1f\n", len, mb / legacy, mb / slice);
+    }
+
+    free(buf);
+    return 0;
+}
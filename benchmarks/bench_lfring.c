@@ -0,0 +1,223 @@
+#if defined __linux__
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "lfring.h"
+#include "ringbuf.h"
+
+#define NR_RECORDS 2000000
+#define RECORD_SIZE 64
+#define RING_SIZE (64 * 1024)
+#define MAX_PAIRS 8
+#define MAX_PRODUCERS 4
+
+struct bench {
+    int cpu;
+    spsc_ring_t *spsc;
+    mpsc_ring_t *mpsc;
+    ringbuf_t *ring; // the mutex guarded baseline
+    pthread_mutex_t *lock;
+    int count;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void pin(int cpu)
+{
+#if defined __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+// spin a while before giving the core away, producers may share it
+static void backoff(int *misses)
+{
+    if (++*misses % 1024 == 0)
+        sched_yield();
+}
+
+static void *spsc_producer(void *arg)
+{
+    struct bench *b = arg;
+    char record[RECORD_SIZE] = {0};
+    int misses = 0;
+    pin(b->cpu);
+    for (int i = 0; i < b->count;) {
+        if (spsc_ring_spare(b->spsc) >= sizeof(record)) {
+            spsc_ring_write(b->spsc, record, sizeof(record));
+            i++;
+        } else {
+            backoff(&misses);
+        }
+    }
+    return NULL;
+}
+
+static void *mutex_producer(void *arg)
+{
+    struct bench *b = arg;
+    char record[RECORD_SIZE] = {0};
+    int misses = 0;
+    pin(b->cpu);
+    for (int i = 0; i < b->count;) {
+        pthread_mutex_lock(b->lock);
+        int full = ringbuf_spare(b->ring) <= sizeof(record);
+        if (!full)
+            ringbuf_write(b->ring, record, sizeof(record));
+        pthread_mutex_unlock(b->lock);
+        if (full)
+            backoff(&misses);
+        else
+            i++;
+    }
+    return NULL;
+}
+
+static void *mpsc_producer(void *arg)
+{
+    struct bench *b = arg;
+    int misses = 0;
+    pin(b->cpu);
+    for (intptr_t i = 0; i < b->count;) {
+        if (mpsc_ring_push(b->mpsc, (void *)i) == 0)
+            i++;
+        else
+            backoff(&misses);
+    }
+    return NULL;
+}
+
+static double bench_spsc(int producer_cpu, int consumer_cpu)
+{
+    struct bench b = {
+        .cpu = producer_cpu,
+        .spsc = spsc_ring_new(RING_SIZE),
+        .count = NR_RECORDS,
+    };
+    char record[RECORD_SIZE];
+    int misses = 0;
+
+    pin(consumer_cpu);
+    double begin = now();
+    pthread_t pid;
+    pthread_create(&pid, NULL, spsc_producer, &b);
+    for (int i = 0; i < NR_RECORDS;) {
+        if (spsc_ring_used(b.spsc) >= sizeof(record)) {
+            spsc_ring_read(b.spsc, record, sizeof(record));
+            i++;
+        } else {
+            backoff(&misses);
+        }
+    }
+    pthread_join(pid, NULL);
+    double elapsed = now() - begin;
+
+    spsc_ring_delete(b.spsc);
+    return NR_RECORDS / elapsed;
+}
+
+static double bench_mutex(int producer_cpu, int consumer_cpu)
+{
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    struct bench b = {
+        .cpu = producer_cpu,
+        .ring = ringbuf_new(RING_SIZE),
+        .lock = &lock,
+        .count = NR_RECORDS,
+    };
+    char record[RECORD_SIZE];
+    int misses = 0;
+
+    pin(consumer_cpu);
+    double begin = now();
+    pthread_t pid;
+    pthread_create(&pid, NULL, mutex_producer, &b);
+    for (int i = 0; i < NR_RECORDS;) {
+        pthread_mutex_lock(&lock);
+        int empty = ringbuf_used(b.ring) < sizeof(record);
+        if (!empty)
+            ringbuf_read(b.ring, record, sizeof(record));
+        pthread_mutex_unlock(&lock);
+        if (empty)
+            backoff(&misses);
+        else
+            i++;
+    }
+    pthread_join(pid, NULL);
+    double elapsed = now() - begin;
+
+    ringbuf_delete(b.ring);
+    return NR_RECORDS / elapsed;
+}
+
+static double bench_mpsc(int nr_producers, int ncpu)
+{
+    mpsc_ring_t *ring = mpsc_ring_new(RING_SIZE / sizeof(void *));
+    struct bench b[MAX_PRODUCERS];
+    pthread_t pids[MAX_PRODUCERS];
+    int total = NR_RECORDS / nr_producers * nr_producers;
+    int misses = 0;
+
+    pin(0);
+    double begin = now();
+    for (int i = 0; i < nr_producers; i++) {
+        b[i] = (struct bench){
+            .cpu = (i + 1) % ncpu,
+            .mpsc = ring,
+            .count = NR_RECORDS / nr_producers,
+        };
+        pthread_create(&pids[i], NULL, mpsc_producer, &b[i]);
+    }
+    for (int i = 0; i < total;) {
+        void *data;
+        if (mpsc_ring_pop(ring, &data) == 0)
+            i++;
+        else
+            backoff(&misses);
+    }
+    for (int i = 0; i < nr_producers; i++)
+        pthread_join(pids[i], NULL);
+    double elapsed = now() - begin;
+
+    mpsc_ring_delete(ring);
+    return total / elapsed;
+}
+
+int main(void)
+{
+    int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1)
+        ncpu = 1;
+
+    printf("spsc, %d records of %d bytes\n", NR_RECORDS, RECORD_SIZE);
+    printf("%8s %8s %14s %14s\n", "producer", "consumer", "mutex Mrec/s", "spsc Mrec/s");
+    for (int cpu = ncpu > 1 ? 1 : 0; cpu < ncpu && cpu <= MAX_PAIRS; cpu++) {
+        double mutex = bench_mutex(0, cpu);
+        double spsc = bench_spsc(0, cpu);
+        printf("%8d %8d %14.2f %14.2f\n", 0, cpu, mutex / 1e6, spsc / 1e6);
+    }
+
+    printf("mpsc, %d pointers\n", NR_RECORDS);
+    printf("%9s %14s\n", "producers", "mpsc Mops/s");
+    for (int n = 1; n <= MAX_PRODUCERS; n++)
+        printf("%9d %14.2f\n", n, bench_mpsc(n, ncpu) / 1e6);
+
+    return 0;
+}
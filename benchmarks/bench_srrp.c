@@ -0,0 +1,166 @@
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "srrp.h"
+
+#define NR_PACKETS 100000
+#define NR_ROUNDS 10
+#define NOISE_SIZE (1024 * 1024)
+
+/*
+ * The sscanf + strstr reader srrp_parse replaced, kept as the baseline.
+ */
+static struct srrp_packet *legacy_read_one_request(const char *buf)
+{
+    char leader, seat;
+    uint32_t seqno, len, srcid;
+
+    int cnt = sscanf(buf, "%c%x,%c,%4x,%4x:", &leader, &seqno, &seat, &len, &srcid);
+    if (cnt != 5) return NULL;
+
+    const char *header_delimiter = strstr(buf, ":/");
+    const char *data_delimiter = strstr(buf, "?{");
+    if (header_delimiter == NULL || data_delimiter == NULL)
+        return NULL;
+
+    struct srrp_packet *pac = calloc(1, sizeof(*pac) + len);
+    memcpy(pac->raw, buf, len);
+    pac->leader = leader;
+    pac->seat = seat;
+    pac->seqno = seqno;
+    pac->len = len;
+    pac->srcid = srcid;
+
+    const char *header = header_delimiter + 1;
+    const char *data = data_delimiter + 1;
+    pac->header_len = data_delimiter - header;
+    memcpy((void *)pac->header, header, pac->header_len);
+    pac->data = pac->raw + (data - buf);
+    pac->data_len = buf + strlen(buf) - data;
+
+    int retval =  3 + 2 + 5 + 5 + pac->header_len + 1 + pac->data_len + 1/*stop*/;
+    if (retval != pac->len) {
+        free(pac);
+        return NULL;
+    }
+    return pac;
+}
+
+/*
+ * The byte loop srrp_parse_view used to skip text noise with, kept as
+ * the baseline of resync.
+ */
+static size_t legacy_next_leader(const char *buf, size_t len)
+{
+    for (size_t i = 1; i < len; i++) {
+        if ((buf[i] == SRRP_REQUEST_LEADER || buf[i] == SRRP_RESPONSE_LEADER ||
+             buf[i] == SRRP_SUBSCRIBE_LEADER || buf[i] == SRRP_UNSUBSCRIBE_LEADER ||
+             buf[i] == SRRP_PUBLISH_LEADER || buf[i] == SRRP_ACK_LEADER) &&
+            (i + 1 == len || isdigit(buf[i + 1])))
+            return i;
+    }
+    return len;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+    struct srrp_packet *pac = srrp_write_request(
+        0x3333, "/8888/motor/speed", "{speed:12,voltage:24,current:2}");
+
+    // a receive buffer with NR_PACKETS back to back, as in sinkfd->rxbuf
+    size_t len = (size_t)pac->len * NR_PACKETS;
+    char *buf = malloc(len + 1);
+    for (int i = 0; i < NR_PACKETS; i++)
+        memcpy(buf + (size_t)pac->len * i, pac->raw, pac->len);
+    buf[len] = 0;
+
+    // and the same packets in the binary framing
+    struct srrp_packet *bin = srrp_convert(pac, SRRP_FRAMING_BINARY);
+    size_t bin_len = (size_t)bin->len * NR_PACKETS;
+    char *bin_buf = malloc(bin_len);
+    for (int i = 0; i < NR_PACKETS; i++)
+        memcpy(bin_buf + (size_t)bin->len * i, bin->raw, bin->len);
+
+    double legacy = 0, parse = 0, parse_bin = 0;
+
+    for (int round = 0; round < NR_ROUNDS; round++) {
+        double begin = now();
+        for (size_t off = 0; off < len;) {
+            struct srrp_packet *rx = legacy_read_one_request(buf + off);
+            assert(rx);
+            off += rx->len;
+            srrp_free(rx);
+        }
+        legacy += now() - begin;
+
+        begin = now();
+        for (size_t off = 0; off < len;) {
+            size_t consumed;
+            struct srrp_packet *rx = srrp_parse(buf + off, len - off, &consumed);
+            assert(rx);
+            off += consumed;
+            srrp_free(rx);
+        }
+        parse += now() - begin;
+
+        begin = now();
+        for (size_t off = 0; off < bin_len;) {
+            size_t consumed;
+            struct srrp_packet *rx = srrp_parse(bin_buf + off, bin_len - off, &consumed);
+            assert(rx);
+            off += consumed;
+            srrp_free(rx);
+        }
+        parse_bin += now() - begin;
+    }
+
+    double total = (double)NR_PACKETS * NR_ROUNDS;
+    printf("packet: %d bytes, binary %d bytes, %d packets x %d rounds\n",
+           pac->len, bin->len, NR_PACKETS, NR_ROUNDS);
+    printf("legacy sscanf: %8.1f ns/packet\n", legacy / total * 1e9);
+    printf("srrp_parse:    %8.1f ns/packet\n", parse / total * 1e9);
+    printf("binary:        %8.1f ns/packet\n", parse_bin / total * 1e9);
+
+    // a noisy line: one packet after a run of bytes that can not begin one
+    char *noise = malloc(NOISE_SIZE + pac->len + 1);
+    for (size_t i = 0; i < NOISE_SIZE; i++)
+        noise[i] = i % 61 == 7 ? SRRP_PUBLISH_LEADER : 'a' + i % 26;
+    memcpy(noise + NOISE_SIZE, pac->raw, pac->len);
+    noise[NOISE_SIZE + pac->len] = 0;
+
+    double resync_legacy = 0, resync = 0;
+    for (int round = 0; round < NR_ROUNDS; round++) {
+        double begin = now();
+        size_t offset = legacy_next_leader(noise, NOISE_SIZE + pac->len);
+        resync_legacy += now() - begin;
+        assert(offset == NOISE_SIZE);
+
+        begin = now();
+        struct srrp_view view;
+        size_t consumed;
+        srrp_parse_view(&view, noise, NOISE_SIZE + pac->len, &consumed);
+        resync += now() - begin;
+        assert(consumed == NOISE_SIZE);
+    }
+
+    double mb = (double)NOISE_SIZE * NR_ROUNDS / 1e6;
+    printf("resync legacy: %8.1f MB/s\n", mb / resync_legacy);
+    printf("resync:        %8.1f MB/s\n", mb / resync);
+
+    free(noise);
+    free(bin_buf);
+    srrp_free(bin);
+    free(buf);
+    srrp_free(pac);
+    return 0;
+}
@@ -1,5 +1,8 @@
 #if defined __unix__ || defined __linux__ || defined __APPLE__
 
+#if defined __linux__
+#define _GNU_SOURCE // accept4, recvmmsg, sendmmsg
+#endif
 #include <assert.h>
 #include <errno.h>
 #include <string.h>
@@ -11,6 +14,10 @@
 #include <unistd.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#if defined __linux__
+#include <sys/epoll.h>
+#endif
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -20,20 +27,456 @@
 #include "apix-private.h"
 #include "apix-posix.h"
 #include "atbuf.h"
+#include "chainbuf.h"
 #include "stddefx.h"
 #include "list.h"
 #include "log.h"
 
-struct posix_sink {
-    struct apisink sink;
-    // for select
+#define POSIX_EVENT_MAX 256
+#define POSIX_WRITE_IOV_MAX 16
+#define POSIX_LISTEN_BACKLOG SOMAXCONN
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/*
+ * event backend
+ *
+ * The posix sinks of a bus share one event backend. Each sinkfd is registered once
+ * when it is opened or accepted, and is dispatched directly from the ready
+ * list, so a poll costs O(ready fds). On linux it is an edge-triggered
+ * epoll, elsewhere it falls back to select.
+ *
+ * Sockets are non-blocking. Packets sent during a poll are coalesced in
+ * the chained txbuf of the sinkfd and flushed with one writev of its
+ * blocks per fd when the bus calls flush, what the kernel does not take
+ * waits for the fd to turn writable.
+ */
+
+struct posix_event {
+#if defined __linux__
+    int epfd;
+#else
     fd_set fds;
     int nfds;
+#endif
 };
 
-// unix domain socket
+struct posix_ctx;
+struct udp_ctx;
+
+struct posix_sink {
+    struct apisink sink;
+    struct posix_ctx *ctx;
+};
+
+// what apibus_enable_posix sets up for a bus
+struct posix_ctx {
+    struct posix_event event;
+    struct list_head flush_list; // sinkfds with unflushed txbuf
+    struct posix_sink unix_sink;
+    struct posix_sink tcp_sink;
+    struct posix_sink serial_sink;
+    struct posix_sink udp_sink;
+    struct udp_ctx *udp; // allocated by the first udp_open
+};
+
+#define posix_ctx_of(sinkfd) \
+    (container_of((sinkfd)->sink, struct posix_sink, sink)->ctx)
+
+static void posix_event_init(struct posix_event *event)
+{
+#if defined __linux__
+    event->epfd = epoll_create1(EPOLL_CLOEXEC);
+    assert(event->epfd != -1);
+#else
+    FD_ZERO(&event->fds);
+    event->nfds = 0;
+#endif
+}
+
+static void posix_event_fini(struct posix_event *event)
+{
+#if defined __linux__
+    close(event->epfd);
+    event->epfd = -1;
+#else
+    FD_ZERO(&event->fds);
+    event->nfds = 0;
+#endif
+}
+
+static int posix_event_add(struct sinkfd *sinkfd)
+{
+    struct posix_event *event = &posix_ctx_of(sinkfd)->event;
+#if defined __linux__
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLET;
+    if (sinkfd->listen == 0)
+        ev.events |= EPOLLOUT;
+    ev.data.ptr = sinkfd;
+    return epoll_ctl(event->epfd, EPOLL_CTL_ADD, sinkfd->fd, &ev);
+#else
+    if (sinkfd->fd >= FD_SETSIZE)
+        return -1;
+    FD_SET(sinkfd->fd, &event->fds);
+    if (event->nfds < sinkfd->fd + 1)
+        event->nfds = sinkfd->fd + 1;
+    return 0;
+#endif
+}
+
+/*
+ * Edge-triggered fds only report new data, so a sinkfd that stopped
+ * reading before EAGAIN (rxbuf full at its cap) is re-armed to be
+ * reported again.
+ */
+static void posix_event_rearm(struct sinkfd *sinkfd)
+{
+#if defined __linux__
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = sinkfd;
+    epoll_ctl(posix_ctx_of(sinkfd)->event.epfd, EPOLL_CTL_MOD, sinkfd->fd, &ev);
+#else
+    UNUSED(sinkfd);
+#endif
+}
+
+static void posix_event_del(struct sinkfd *sinkfd)
+{
+#if defined __linux__
+    epoll_ctl(posix_ctx_of(sinkfd)->event.epfd, EPOLL_CTL_DEL, sinkfd->fd, NULL);
+#else
+    FD_CLR(sinkfd->fd, &posix_ctx_of(sinkfd)->event.fds);
+#endif
+}
+
+static void posix_sinkfd_close(struct sinkfd *sinkfd)
+{
+    posix_event_del(sinkfd);
+    close(sinkfd->fd);
+    sinkfd_destroy(sinkfd);
+}
+
+static struct sinkfd *posix_sinkfd_new(struct apisink *sink, int fd)
+{
+    struct sinkfd *sinkfd = sinkfd_new(sink, fd);
+    if (sinkfd == NULL)
+        return NULL;
+    if (posix_event_add(sinkfd) == -1) {
+        LOG_ERROR("[event] (%d) %s", errno, strerror(errno));
+        sinkfd_destroy(sinkfd);
+        return NULL;
+    }
+    return sinkfd;
+}
+
+static int posix_adopt(struct apisink *sink, int fd)
+{
+    return posix_sinkfd_new(sink, fd) ? 0 : -1;
+}
+
+/*
+ * The backlog is drained until EAGAIN. In a group, the fds accepted by a
+ * listener of its own are spread over the shards, those of a reuseport
+ * listener are already spread by the kernel. Only the fds kept by the
+ * listener take its rx_cap, the others start with the default.
+ */
+static void posix_accept(struct sinkfd *sinkfd)
+{
+    struct apisink *sink = sinkfd->sink;
+
+    for (;;) {
+#if defined __linux__
+        int newfd = accept4(sinkfd->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        int newfd = accept(sinkfd->fd, NULL, NULL);
+#endif
+        if (newfd == -1) {
+            // the peer gave up while queued, go on with the others
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERROR("[accept] (%d) %s", errno, strerror(errno));
+            break;
+        }
+
+#if !defined __linux__
+        fcntl(newfd, F_SETFL, fcntl(newfd, F_GETFL) | O_NONBLOCK);
+        fcntl(newfd, F_SETFD, FD_CLOEXEC);
+#endif
+        if (sinkfd->reuseport == 0 &&
+            apibus_handoff_fd(sink->bus, sink->name, newfd) == 0)
+            continue;
+        struct sinkfd *accepted = posix_sinkfd_new(sink, newfd);
+        if (accepted)
+            accepted->rx_cap = sinkfd->rx_cap;
+        else
+            close(newfd);
+    }
+}
+
+static void posix_read(struct sinkfd *sinkfd)
+{
+    int is_serial = sinkfd->sink == &posix_ctx_of(sinkfd)->serial_sink.sink;
+
+    for (;;) {
+        size_t spare = sinkfd_rx_spare(sinkfd);
+        if (spare == 0) {
+            posix_event_rearm(sinkfd);
+            break;
+        }
+
+        int nread;
+        if (is_serial)
+            nread = read(sinkfd->fd, atbuf_write_pos(sinkfd->rxbuf), spare);
+        else
+            nread = recv(sinkfd->fd, atbuf_write_pos(sinkfd->rxbuf),
+                         spare, MSG_DONTWAIT);
+
+        if (nread == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            LOG_DEBUG("[read] (%d) %s", errno, strerror(errno));
+            posix_sinkfd_close(sinkfd);
+            break;
+        } else if (nread == 0) {
+            // the bus parses what is left in this poll, then closes it
+            if (atbuf_used(sinkfd->rxbuf)) {
+                sinkfd->eof = 1;
+                break;
+            }
+            LOG_DEBUG("[read] #%d finished", sinkfd->fd);
+            posix_sinkfd_close(sinkfd);
+            break;
+        } else {
+            sinkfd_rx_advance(sinkfd, nread);
+            gettimeofday(&sinkfd->ts_poll_recv, NULL);
+        }
+    }
+}
 
-static struct posix_sink __unix_sink;
+static int posix_write(struct sinkfd *sinkfd, struct iovec *iov, int iovcnt)
+{
+    for (;;) {
+        if (sinkfd->sink->bus)
+            sinkfd->sink->bus->tx_syscalls++;
+
+        int nwrite;
+        if (sinkfd->sink == &posix_ctx_of(sinkfd)->serial_sink.sink) {
+            nwrite = writev(sinkfd->fd, iov, iovcnt);
+        } else {
+            struct msghdr msg = {0};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iovcnt;
+            nwrite = sendmsg(sinkfd->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+
+        if (nwrite == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+        }
+        return nwrite;
+    }
+}
+
+static int posix_flush(struct sinkfd *sinkfd)
+{
+    while (chainbuf_used(sinkfd->txbuf)) {
+        struct chainbuf_vec vec[POSIX_WRITE_IOV_MAX];
+        struct iovec iov[POSIX_WRITE_IOV_MAX];
+        int cnt = chainbuf_read_vec(sinkfd->txbuf, vec, POSIX_WRITE_IOV_MAX);
+        for (int i = 0; i < cnt; i++) {
+            iov[i].iov_base = vec[i].base;
+            iov[i].iov_len = vec[i].len;
+        }
+
+        int nwrite = posix_write(sinkfd, iov, cnt);
+        if (nwrite == -1) {
+            LOG_DEBUG("[write] (%d) %s", errno, strerror(errno));
+            return -1;
+        }
+        if (nwrite == 0) {
+            sinkfd->tx_blocked = 1;
+            break;
+        }
+        chainbuf_read_advance(sinkfd->txbuf, nwrite);
+    }
+    return 0;
+}
+
+static void udp_recv_all(struct sinkfd *sock);
+static void udp_expire(struct posix_ctx *ctx);
+
+static void posix_dispatch(struct sinkfd *sinkfd, int readable, int writable)
+{
+    if (sinkfd->sink == &posix_ctx_of(sinkfd)->udp_sink.sink) {
+        if (readable)
+            udp_recv_all(sinkfd);
+        return;
+    }
+
+    if (sinkfd->listen == 1) {
+        posix_accept(sinkfd);
+        return;
+    }
+
+    if (writable) {
+        sinkfd->tx_blocked = 0;
+        if (posix_flush(sinkfd) == -1) {
+            posix_sinkfd_close(sinkfd);
+            return;
+        }
+    }
+
+    if (readable)
+        posix_read(sinkfd);
+}
+
+/*
+ * The backend is shared, so whichever posix sink is polled first
+ * dispatches the ready sinkfds of all of them.
+ */
+static int posix_poll(struct apisink *sink)
+{
+    struct posix_ctx *ctx = container_of(sink, struct posix_sink, sink)->ctx;
+
+#if defined __linux__
+    struct epoll_event events[POSIX_EVENT_MAX];
+    int nr = epoll_wait(ctx->event.epfd, events, POSIX_EVENT_MAX, 0);
+    if (nr == -1) {
+        if (errno == EINTR)
+            return 0;
+        LOG_ERROR("[epoll_wait] (%d) %s", errno, strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < nr; i++) {
+        posix_dispatch(events[i].data.ptr,
+                       events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR),
+                       events[i].events & EPOLLOUT);
+    }
+#else
+    struct posix_sink *sinks[] = {
+        &ctx->unix_sink, &ctx->tcp_sink, &ctx->serial_sink, &ctx->udp_sink };
+    struct timeval tv = { 0, 0 };
+    fd_set recvfds, sendfds;
+    memcpy(&recvfds, &ctx->event.fds, sizeof(recvfds));
+    FD_ZERO(&sendfds);
+
+    // only fds with queued data are waited for writability
+    for (size_t i = 0; i < sizeof(sinks) / sizeof(sinks[0]); i++) {
+        struct sinkfd *pos;
+        list_for_each_entry(pos, &sinks[i]->sink.sinkfds, node_sink) {
+            if (pos->fd >= 0 && chainbuf_used(pos->txbuf))
+                FD_SET(pos->fd, &sendfds);
+        }
+    }
+
+    int nr = select(ctx->event.nfds, &recvfds, &sendfds, NULL, &tv);
+    if (nr == -1) {
+        if (errno == EINTR)
+            return 0;
+        LOG_ERROR("[select] (%d) %s", errno, strerror(errno));
+        return -1;
+    }
+
+    for (size_t i = 0; i < sizeof(sinks) / sizeof(sinks[0]) && nr; i++) {
+        struct sinkfd *pos, *n;
+        list_for_each_entry_safe(pos, n, &sinks[i]->sink.sinkfds, node_sink) {
+            if (nr == 0) break;
+            // the virtual sinkfds of udp peers
+            if (pos->fd < 0)
+                continue;
+            int readable = FD_ISSET(pos->fd, &recvfds);
+            int writable = FD_ISSET(pos->fd, &sendfds);
+            if (!readable && !writable)
+                continue;
+            nr -= (readable != 0) + (writable != 0);
+            posix_dispatch(pos, readable, writable);
+        }
+    }
+#endif
+
+    if (ctx->udp)
+        udp_expire(ctx);
+    return 0;
+}
+
+/*
+ * Packets are appended to the txbuf and written out by posix_flush_all,
+ * or when the fd turns writable if the kernel is full. A packet that
+ * would take the txbuf beyond tx_hwm forces an early flush, and is
+ * handled by tx_policy if the txbuf still can not take it.
+ */
+static int posix_send(struct apisink *sink, int fd, const void *buf, size_t len)
+{
+    struct sinkfd *sinkfd = find_sinkfd_in_apisink(sink, fd);
+    if (sinkfd == NULL)
+        return -1;
+
+    if (chainbuf_used(sinkfd->txbuf) + len > sinkfd->tx_hwm &&
+        sinkfd->tx_blocked == 0 && posix_flush(sinkfd) == -1)
+        return -1;
+
+    if (chainbuf_used(sinkfd->txbuf) + len > sinkfd->tx_hwm) {
+        if (sink->bus)
+            sink->bus->tx_drops++;
+        if (sinkfd->tx_policy == APIBUS_TX_POLICY_CLOSE) {
+            // the sinkfd is closed by posix_read once the shutdown is seen
+            LOG_WARN("[send] #%d exceeds tx hwm, shutdown", fd);
+            shutdown(fd, SHUT_RDWR);
+            chainbuf_read_advance(sinkfd->txbuf, chainbuf_used(sinkfd->txbuf));
+        } else {
+            LOG_DEBUG("[send] #%d exceeds tx hwm, drop %d bytes", fd, (int)len);
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+
+    chainbuf_write(sinkfd->txbuf, buf, len);
+    if (sink->bus)
+        sink->bus->tx_packets++;
+    if (sinkfd->tx_blocked == 0 && list_empty(&sinkfd->node_flush))
+        list_add_tail(&sinkfd->node_flush, &posix_ctx_of(sinkfd)->flush_list);
+    return len;
+}
+
+/*
+ * The flush list is shared, so whichever posix sink is flushed first
+ * writes out the sinkfds of all of them.
+ */
+static int posix_flush_all(struct apisink *sink)
+{
+    struct posix_ctx *ctx = container_of(sink, struct posix_sink, sink)->ctx;
+
+    struct sinkfd *pos, *n;
+    list_for_each_entry_safe(pos, n, &ctx->flush_list, node_flush) {
+        list_del_init(&pos->node_flush);
+        if (pos->tx_blocked == 0 && posix_flush(pos) == -1)
+            posix_sinkfd_close(pos);
+    }
+
+    return 0;
+}
+
+static int posix_waitfd(struct apisink *sink)
+{
+#if defined __linux__
+    return container_of(sink, struct posix_sink, sink)->ctx->event.epfd;
+#else
+    UNUSED(sink);
+    return -1;
+#endif
+}
+
+// unix domain socket
 
 static int unix_open(struct apisink *sink, const char *addr)
 {
@@ -53,210 +496,599 @@ static int unix_open(struct apisink *sink, const char *addr)
         return -1;
     }
 
-    rc = listen(fd, 100);
+    rc = listen(fd, POSIX_LISTEN_BACKLOG);
     if (rc == -1) {
         close(fd);
         return -1;
     }
 
-    struct sinkfd *sinkfd = sinkfd_new();
-    sinkfd->fd = fd;
+    // accept is drained until EAGAIN on each edge
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    struct sinkfd *sinkfd = sinkfd_new(sink, fd);
+    if (sinkfd == NULL) {
+        close(fd);
+        return -1;
+    }
     sinkfd->listen = 1;
     snprintf(sinkfd->addr, sizeof(sinkfd->addr), "%s", addr);
-    sinkfd->sink = sink;
-    list_add(&sinkfd->node_sink, &sink->sinkfds);
-    list_add(&sinkfd->node_bus, &sink->bus->sinkfds);
 
-    struct posix_sink *unix_sink = container_of(sink, struct posix_sink, sink);
-    FD_SET(fd, &unix_sink->fds);
-    unix_sink->nfds = fd + 1;
+    if (posix_event_add(sinkfd) == -1) {
+        close(fd);
+        sinkfd_destroy(sinkfd);
+        return -1;
+    }
 
     return fd;
 }
 
+static int
+posix_ioctl(struct apisink *sink, int fd, unsigned int cmd, unsigned long arg)
+{
+    struct sinkfd *sinkfd = find_sinkfd_in_apisink(sink, fd);
+    if (sinkfd == NULL || sinkfd->listen == 0 || cmd != APISINK_IOCTL_BACKLOG)
+        return -1;
+    // listen on a listening socket only sets its backlog
+    return listen(fd, (int)arg);
+}
+
 static int unix_close(struct apisink *sink, int fd)
 {
     struct sinkfd *sinkfd = find_sinkfd_in_apisink(sink, fd);
     if (sinkfd == NULL)
         return -1;
-    close(sinkfd->fd);
     unlink(sinkfd->addr);
-    sinkfd_destroy(sinkfd);
+    posix_sinkfd_close(sinkfd);
     return 0;
 }
 
-static int unix_send(struct apisink *sink, int fd, const void *buf, size_t len)
+static int unix_recv(struct apisink *sink, int fd, void *buf, size_t size)
 {
     UNUSED(sink);
-    return send(fd, buf, len, 0);
+    return recv(fd, buf, size, 0);
 }
 
-static int unix_recv(struct apisink *sink, int fd, void *buf, size_t size)
+static apisink_ops_t unix_ops = {
+    .open = unix_open,
+    .close = unix_close,
+    .ioctl = posix_ioctl,
+    .send = posix_send,
+    .recv = unix_recv,
+    .poll = posix_poll,
+    .flush = posix_flush_all,
+    .waitfd = posix_waitfd,
+    .adopt = posix_adopt,
+};
+
+// tcp
+
+// addr is "host:port"
+static int inet_sockaddr(struct sockaddr_in *sockaddr, const char *addr)
 {
-    UNUSED(sink);
-    return recv(fd, buf, size, 0);
+    const char *colon = strchr(addr, ':');
+    if (colon == NULL || colon - addr >= INET_ADDRSTRLEN)
+        return -1;
+
+    char host[INET_ADDRSTRLEN] = {0};
+    memcpy(host, addr, colon - addr);
+    memset(sockaddr, 0, sizeof(*sockaddr));
+    sockaddr->sin_family = PF_INET;
+    sockaddr->sin_addr.s_addr = inet_addr(host);
+    sockaddr->sin_port = htons(atoi(colon + 1));
+    return 0;
 }
 
-static int unix_poll(struct apisink *sink)
+static int
+tcp_listen(struct apisink *sink, const char *addr, int backlog, int reuseport)
 {
-    struct posix_sink *unix_sink = container_of(sink, struct posix_sink, sink);
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
 
-    struct timeval tv = { 0, 0 };
-    fd_set recvfds;
-    memcpy(&recvfds, &unix_sink->fds, sizeof(recvfds));
+#if defined SO_REUSEPORT
+    int on = 1;
+    if (reuseport &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+        close(fd);
+        return -1;
+    }
+#endif
 
-    int nr_recv_fds = select(unix_sink->nfds, &recvfds, NULL, NULL, &tv);
-    if (nr_recv_fds == -1) {
-        if (errno == EINTR)
-            return 0;
-        LOG_ERROR("[select] (%d) %s", errno, strerror(errno));
+    struct sockaddr_in sockaddr;
+    if (inet_sockaddr(&sockaddr, addr) == -1) {
+        close(fd);
         return -1;
     }
 
-    struct sinkfd *pos, *n;
-    list_for_each_entry_safe(pos, n, &sink->sinkfds, node_sink) {
-        if (nr_recv_fds == 0) break;
+    int rc = bind(fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr));
+    if (rc == -1) {
+        close(fd);
+        return -1;
+    }
 
-        if (!FD_ISSET(pos->fd, &recvfds))
-            continue;
+    rc = listen(fd, backlog);
+    if (rc == -1) {
+        close(fd);
+        return -1;
+    }
 
-        nr_recv_fds--;
+    // accept is drained until EAGAIN on each edge
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
 
-        // accept
-        if (pos->listen == 1) {
-            int newfd = accept(pos->fd, NULL, NULL);
-            if (newfd == -1) {
-                LOG_ERROR("[accept] (%d) %s", errno, strerror(errno));
-                continue;
-            }
+    struct sinkfd *sinkfd = sinkfd_new(sink, fd);
+    if (sinkfd == NULL) {
+        close(fd);
+        return -1;
+    }
+    sinkfd->listen = 1;
+    sinkfd->reuseport = reuseport;
+    snprintf(sinkfd->addr, sizeof(sinkfd->addr), "%s", addr);
 
-            struct sinkfd *sinkfd = sinkfd_new();
-            sinkfd->fd = newfd;
-            sinkfd->sink = sink;
-            list_add(&sinkfd->node_sink, &sink->sinkfds);
-            list_add(&sinkfd->node_bus, &sink->bus->sinkfds);
-
-            if (unix_sink->nfds < newfd + 1)
-                unix_sink->nfds = newfd + 1;
-            FD_SET(newfd, &unix_sink->fds);
-        } else /* recv */ {
-            int nread = recv(pos->fd, atbuf_write_pos(pos->rxbuf),
-                             atbuf_spare(pos->rxbuf), 0);
-            if (nread == -1) {
-                LOG_DEBUG("[recv] (%d) %s", errno, strerror(errno));
-                sinkfd_destroy(pos);
-            } else if (nread == 0) {
-                LOG_DEBUG("[recv] (%d) finished");
-                sinkfd_destroy(pos);
-            } else {
-                atbuf_write_advance(pos->rxbuf, nread);
-                gettimeofday(&pos->ts_poll_recv, NULL);
-            }
-        }
+    if (posix_event_add(sinkfd) == -1) {
+        close(fd);
+        sinkfd_destroy(sinkfd);
+        return -1;
     }
 
+    return fd;
+}
+
+static int tcp_open(struct apisink *sink, const char *addr)
+{
+    return tcp_listen(sink, addr, POSIX_LISTEN_BACKLOG, 0);
+}
+
+static int tcp_close(struct apisink *sink, int fd)
+{
+    struct sinkfd *sinkfd = find_sinkfd_in_apisink(sink, fd);
+    if (sinkfd == NULL)
+        return -1;
+    posix_sinkfd_close(sinkfd);
     return 0;
 }
 
-static apisink_ops_t unix_ops = {
-    .open = unix_open,
-    .close = unix_close,
-    .ioctl = NULL,
-    .send = unix_send,
+static apisink_ops_t tcp_ops = {
+    .open = tcp_open,
+    .close = tcp_close,
+    .ioctl = posix_ioctl,
+    .send = posix_send,
     .recv = unix_recv,
-    .poll = unix_poll,
+    .poll = posix_poll,
+    .flush = posix_flush_all,
+    .waitfd = posix_waitfd,
+    .adopt = posix_adopt,
 };
 
-// tcp
+// udp
+
+#define UDP_BATCH 32
+#define UDP_PEER_HASH_SIZE 1021
+#define UDP_PEER_MAX 4096
+#define UDP_PEER_TIMEOUT 60 // seconds
+#define UDP_VFD_MIN (-(1 << 30))
+
+/*
+ * Each datagram carries one whole packet, others are dropped. A udp
+ * socket has no connections, so every peer address it hears from gets a
+ * virtual sinkfd, numbered from -2 down and never registered in the
+ * event backend, that the bus uses like an accepted fd. A peer silent for UDP_PEER_TIMEOUT, or the least
+ * recently active one beyond UDP_PEER_MAX, goes away like a closed fd.
+ *
+ * Datagrams are read with recvmmsg until EAGAIN. Packets sent to peers
+ * are queued and written with one sendmmsg per socket at flush, or
+ * earlier when UDP_BATCH are queued, what the kernel does not take is
+ * dropped as udp would.
+ */
+
+struct udp_peer {
+    struct sockaddr_in addr;
+    struct sinkfd *sinkfd; // the virtual one
+    struct sinkfd *sock; // the udp socket it talks to
+    time_t ts_active;
+    struct hlist_node node_hash;
+    struct list_head node; // udp_ctx.peers, least recently active first
+};
 
-static struct posix_sink __tcp_sink;
+struct udp_dgram {
+    struct sockaddr_in addr; // source of rx, destination of tx
+    int fd; // socket of tx, -1 once it is closed
+    size_t len;
+    char buf[SRRP_LENGTH_MAX];
+};
 
-static int tcp_open(struct apisink *sink, const char *addr)
+struct udp_ctx {
+    struct hlist_head peer_hash[UDP_PEER_HASH_SIZE];
+    struct list_head peers;
+    int npeers;
+    int next_vfd;
+    struct udp_dgram rx[UDP_BATCH];
+    struct udp_dgram tx[UDP_BATCH];
+    int ntx;
+};
+
+static unsigned int udp_peer_hash_fn(const struct sockaddr_in *addr)
 {
-    int fd = socket(PF_INET, SOCK_STREAM, 0);
-    if (fd == -1)
+    uint32_t key = ntohl(addr->sin_addr.s_addr) * 31 + ntohs(addr->sin_port);
+    return key % UDP_PEER_HASH_SIZE;
+}
+
+static struct udp_peer *find_udp_peer(
+    struct udp_ctx *udp, struct sinkfd *sock, const struct sockaddr_in *addr)
+{
+    struct udp_peer *pos;
+    hlist_for_each_entry(pos, &udp->peer_hash[udp_peer_hash_fn(addr)], node_hash) {
+        if (pos->sock == sock &&
+            pos->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            pos->addr.sin_port == addr->sin_port)
+            return pos;
+    }
+    return NULL;
+}
+
+static void udp_peer_delete(struct udp_ctx *udp, struct udp_peer *peer)
+{
+    hlist_del(&peer->node_hash);
+    list_del(&peer->node);
+    udp->npeers--;
+    sinkfd_destroy(peer->sinkfd);
+    free(peer);
+}
+
+static struct udp_peer *udp_peer_new(
+    struct udp_ctx *udp, struct sinkfd *sock, const struct sockaddr_in *addr)
+{
+    if (udp->npeers >= UDP_PEER_MAX) {
+        struct udp_peer *oldest =
+            list_first_entry(&udp->peers, struct udp_peer, node);
+        LOG_DEBUG("[udp] #%d %s evicted", oldest->sinkfd->fd, oldest->sinkfd->addr);
+        udp_peer_delete(udp, oldest);
+    }
+
+    int fd;
+    do {
+        fd = udp->next_vfd--;
+        if (udp->next_vfd < UDP_VFD_MIN)
+            udp->next_vfd = -2;
+    } while (find_sinkfd_in_apibus(sock->sink->bus, fd));
+
+    struct udp_peer *peer = calloc(1, sizeof(*peer));
+    if (peer == NULL)
+        return NULL;
+    peer->addr = *addr;
+    peer->sock = sock;
+    peer->sinkfd = sinkfd_new(sock->sink, fd);
+    if (peer->sinkfd == NULL) {
+        free(peer);
+        return NULL;
+    }
+    peer->sinkfd->priv = peer;
+    peer->sinkfd->rx_cap = sock->rx_cap;
+    snprintf(peer->sinkfd->addr, sizeof(peer->sinkfd->addr), "%s:%d",
+             inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+
+    hlist_add_head(&peer->node_hash, &udp->peer_hash[udp_peer_hash_fn(addr)]);
+    list_add_tail(&peer->node, &udp->peers);
+    udp->npeers++;
+    return peer;
+}
+
+static void udp_expire(struct posix_ctx *ctx)
+{
+    struct udp_ctx *udp = ctx->udp;
+    time_t now = time(NULL);
+
+    while (!list_empty(&udp->peers)) {
+        struct udp_peer *peer =
+            list_first_entry(&udp->peers, struct udp_peer, node);
+        if (now - peer->ts_active < UDP_PEER_TIMEOUT)
+            break;
+        LOG_DEBUG("[udp] #%d %s expired", peer->sinkfd->fd, peer->sinkfd->addr);
+        udp_peer_delete(udp, peer);
+    }
+}
+
+// return the number of datagrams read into udp->rx, -1 on error
+static int udp_recv_batch(struct udp_ctx *udp, int fd)
+{
+#if defined __linux__
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < UDP_BATCH; i++) {
+        iov[i].iov_base = udp->rx[i].buf;
+        iov[i].iov_len = sizeof(udp->rx[i].buf);
+        msgs[i].msg_hdr.msg_name = &udp->rx[i].addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(udp->rx[i].addr);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int nr = recvmmsg(fd, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+    for (int i = 0; i < nr; i++) {
+        // a datagram cut to the slot is no packet at all
+        udp->rx[i].len = msgs[i].msg_hdr.msg_flags & MSG_TRUNC ?
+            0 : msgs[i].msg_len;
+    }
+    return nr;
+#else
+    int nr = 0;
+    while (nr < UDP_BATCH) {
+        socklen_t addrlen = sizeof(udp->rx[nr].addr);
+        int len = recvfrom(fd, udp->rx[nr].buf, sizeof(udp->rx[nr].buf),
+                           MSG_DONTWAIT, (struct sockaddr *)&udp->rx[nr].addr,
+                           &addrlen);
+        if (len == -1) {
+            if (nr && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            return nr ? nr : -1;
+        }
+        udp->rx[nr++].len = len;
+    }
+    return nr;
+#endif
+}
+
+static void udp_deliver(struct udp_ctx *udp, struct sinkfd *sock,
+                        struct udp_dgram *dgram)
+{
+    // whole packets only, so nothing is left over to join the next datagram
+    struct srrp_view view;
+    size_t consumed = 0;
+    if (dgram->len == 0 ||
+        srrp_parse_view(&view, dgram->buf, dgram->len, &consumed) != 0 ||
+        consumed != dgram->len) {
+        LOG_DEBUG("[udp] drop %d bytes, not one packet", (int)dgram->len);
+        return;
+    }
+
+    struct udp_peer *peer = find_udp_peer(udp, sock, &dgram->addr);
+    if (peer == NULL) {
+        peer = udp_peer_new(udp, sock, &dgram->addr);
+        if (peer == NULL)
+            return;
+    }
+    peer->ts_active = time(NULL);
+    list_move_tail(&peer->node, &udp->peers);
+
+    struct sinkfd *sinkfd = peer->sinkfd;
+    if (sinkfd_rx_reserve(sinkfd, dgram->len) < dgram->len) {
+        LOG_DEBUG("[udp] #%d rxbuf full, drop %d bytes",
+                  sinkfd->fd, (int)dgram->len);
+        return;
+    }
+
+    memcpy(atbuf_write_pos(sinkfd->rxbuf), dgram->buf, dgram->len);
+    sinkfd_rx_advance(sinkfd, dgram->len);
+    gettimeofday(&sinkfd->ts_poll_recv, NULL);
+}
+
+static void udp_recv_all(struct sinkfd *sock)
+{
+    struct udp_ctx *udp = posix_ctx_of(sock)->udp;
+
+    for (;;) {
+        int nr = udp_recv_batch(udp, sock->fd);
+        if (nr == -1) {
+            if (errno == EINTR)
+                continue;
+            // icmp errors of earlier sends show up here, the socket is fine
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_DEBUG("[udp] (%d) %s", errno, strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < nr; i++)
+            udp_deliver(udp, sock, &udp->rx[i]);
+        if (nr < UDP_BATCH)
+            break;
+    }
+}
+
+// return the number of datagrams the kernel took, the others are dropped
+static int udp_send_batch(struct apibus *bus, struct udp_dgram *tx, int cnt)
+{
+    int sent = 0, taken = 0;
+
+    while (sent < cnt) {
+        if (bus)
+            bus->tx_syscalls++;
+#if defined __linux__
+        struct mmsghdr msgs[UDP_BATCH];
+        struct iovec iov[UDP_BATCH];
+        int n = cnt - sent;
+        memset(msgs, 0, sizeof(msgs[0]) * n);
+        for (int i = 0; i < n; i++) {
+            iov[i].iov_base = tx[sent + i].buf;
+            iov[i].iov_len = tx[sent + i].len;
+            msgs[i].msg_hdr.msg_name = &tx[sent + i].addr;
+            msgs[i].msg_hdr.msg_namelen = sizeof(tx[sent + i].addr);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int nr = sendmmsg(tx[sent].fd, msgs, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+#else
+        int nr = sendto(tx[sent].fd, tx[sent].buf, tx[sent].len,
+                        MSG_DONTWAIT | MSG_NOSIGNAL,
+                        (struct sockaddr *)&tx[sent].addr,
+                        sizeof(tx[sent].addr)) == -1 ? -1 : 1;
+#endif
+        if (nr == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            // refused by the peer or the route, go on with the next one
+            LOG_DEBUG("[udp] (%d) %s", errno, strerror(errno));
+            sent++;
+            continue;
+        }
+        sent += nr;
+        taken += nr;
+    }
+
+    return taken;
+}
+
+static void udp_flush(struct udp_ctx *udp, struct apibus *bus)
+{
+    // a run of datagrams to the same socket goes out with one sendmmsg
+    for (int i = 0, j; i < udp->ntx; i = j) {
+        for (j = i + 1; j < udp->ntx && udp->tx[j].fd == udp->tx[i].fd; j++);
+        int taken = 0;
+        if (udp->tx[i].fd != -1)
+            taken = udp_send_batch(bus, &udp->tx[i], j - i);
+        if (bus)
+            bus->tx_drops += j - i - taken;
+    }
+    udp->ntx = 0;
+}
+
+static int udp_flush_all(struct apisink *sink)
+{
+    struct posix_ctx *ctx = container_of(sink, struct posix_sink, sink)->ctx;
+    if (ctx->udp && ctx->udp->ntx)
+        udp_flush(ctx->udp, sink->bus);
+    return 0;
+}
+
+static int udp_send(struct apisink *sink, int fd, const void *buf, size_t len)
+{
+    struct sinkfd *sinkfd = find_sinkfd_in_apisink(sink, fd);
+    // only peers are sent to, not the socket itself
+    if (sinkfd == NULL || sinkfd->priv == NULL)
+        return -1;
+    if (len > SRRP_LENGTH_MAX) {
+        errno = EMSGSIZE;
         return -1;
+    }
 
-    uint32_t host;
-    uint16_t port;
-    char *tmp = strdup(addr);
-    char *colon = strchr(tmp, ':');
-    *colon = 0;
-    host = inet_addr(tmp);
-    port = htons(atoi(colon + 1));
-    free(tmp);
+    struct udp_ctx *udp = posix_ctx_of(sinkfd)->udp;
+    struct udp_peer *peer = sinkfd->priv;
+    if (udp->ntx == UDP_BATCH)
+        udp_flush(udp, sink->bus);
+
+    struct udp_dgram *dgram = &udp->tx[udp->ntx++];
+    dgram->addr = peer->addr;
+    dgram->fd = peer->sock->fd;
+    dgram->len = len;
+    memcpy(dgram->buf, buf, len);
+    if (sink->bus)
+        sink->bus->tx_packets++;
+    return len;
+}
 
-    int rc = 0;
-    struct sockaddr_in sockaddr = {0};
-    sockaddr.sin_family = PF_INET;
-    sockaddr.sin_addr.s_addr = host;
-    sockaddr.sin_port = port;
+static int udp_open(struct apisink *sink, const char *addr)
+{
+    struct posix_ctx *ctx = container_of(sink, struct posix_sink, sink)->ctx;
+    if (ctx->udp == NULL) {
+        ctx->udp = calloc(1, sizeof(*ctx->udp));
+        if (ctx->udp == NULL)
+            return -1;
+        for (int i = 0; i < UDP_PEER_HASH_SIZE; i++)
+            INIT_HLIST_HEAD(&ctx->udp->peer_hash[i]);
+        INIT_LIST_HEAD(&ctx->udp->peers);
+        ctx->udp->next_vfd = -2;
+    }
 
-    rc = bind(fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr));
-    if (rc == -1) {
+    int fd = socket(PF_INET, SOCK_DGRAM, 0);
+    if (fd == -1)
+        return -1;
+
+    struct sockaddr_in sockaddr;
+    if (inet_sockaddr(&sockaddr, addr) == -1) {
         close(fd);
         return -1;
     }
 
-    rc = listen(fd, 100);
-    if (rc == -1) {
+    if (bind(fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) == -1) {
         close(fd);
         return -1;
     }
 
-    struct sinkfd *sinkfd = sinkfd_new();
-    sinkfd->fd = fd;
+    // datagrams are drained until EAGAIN on each edge
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    struct sinkfd *sinkfd = sinkfd_new(sink, fd);
+    if (sinkfd == NULL) {
+        close(fd);
+        return -1;
+    }
     sinkfd->listen = 1;
     snprintf(sinkfd->addr, sizeof(sinkfd->addr), "%s", addr);
-    sinkfd->sink = sink;
-    list_add(&sinkfd->node_sink, &sink->sinkfds);
-    list_add(&sinkfd->node_bus, &sink->bus->sinkfds);
 
-    struct posix_sink *tcp_sink = container_of(sink, struct posix_sink, sink);
-    FD_SET(fd, &tcp_sink->fds);
-    tcp_sink->nfds = fd + 1;
+    if (posix_event_add(sinkfd) == -1) {
+        close(fd);
+        sinkfd_destroy(sinkfd);
+        return -1;
+    }
 
     return fd;
 }
 
-static int tcp_close(struct apisink *sink, int fd)
+static int udp_close(struct apisink *sink, int fd)
 {
     struct sinkfd *sinkfd = find_sinkfd_in_apisink(sink, fd);
     if (sinkfd == NULL)
         return -1;
-    close(sinkfd->fd);
-    sinkfd_destroy(sinkfd);
+
+    struct udp_ctx *udp = posix_ctx_of(sinkfd)->udp;
+    if (sinkfd->priv) {
+        udp_peer_delete(udp, sinkfd->priv);
+        return 0;
+    }
+
+    // the peers and queued datagrams of the socket go with it
+    struct udp_peer *pos, *n;
+    list_for_each_entry_safe(pos, n, &udp->peers, node) {
+        if (pos->sock == sinkfd)
+            udp_peer_delete(udp, pos);
+    }
+    for (int i = 0; i < udp->ntx; i++) {
+        if (udp->tx[i].fd == fd)
+            udp->tx[i].fd = -1;
+    }
+
+    posix_sinkfd_close(sinkfd);
     return 0;
 }
 
-static apisink_ops_t tcp_ops = {
-    .open = tcp_open,
-    .close = tcp_close,
-    .ioctl = NULL,
-    .send = unix_send,
-    .recv = unix_recv,
-    .poll = unix_poll,
+static int udp_recv(struct apisink *sink, int fd, void *buf, size_t size)
+{
+    UNUSED(sink);
+    return recv(fd, buf, size, 0);
+}
+
+static apisink_ops_t udp_ops = {
+    .open = udp_open,
+    .close = udp_close,
+    .send = udp_send,
+    .recv = udp_recv,
+    .poll = posix_poll,
+    .flush = udp_flush_all,
+    .waitfd = posix_waitfd,
 };
 
 // serial
 
-static struct posix_sink __serial_sink;
-
 static int serial_open(struct apisink *sink, const char *addr)
 {
     int fd = open(addr, O_RDWR | O_NOCTTY | O_NDELAY);
     if (fd == -1) return -1;
 
-    struct sinkfd *sinkfd = sinkfd_new();
-    sinkfd->fd = fd;
+    struct sinkfd *sinkfd = sinkfd_new(sink, fd);
+    if (sinkfd == NULL) {
+        close(fd);
+        return -1;
+    }
     snprintf(sinkfd->addr, sizeof(sinkfd->addr), "%s", addr);
-    sinkfd->sink = sink;
-    list_add(&sinkfd->node_sink, &sink->sinkfds);
-    list_add(&sinkfd->node_bus, &sink->bus->sinkfds);
 
-    struct posix_sink *serial_sink = container_of(sink, struct posix_sink, sink);
-    FD_SET(fd, &serial_sink->fds);
-    serial_sink->nfds = fd + 1;
+    if (posix_event_add(sinkfd) == -1) {
+        close(fd);
+        sinkfd_destroy(sinkfd);
+        return -1;
+    }
 
     return fd;
 }
@@ -266,8 +1098,7 @@ static int serial_close(struct apisink *sink, int fd)
     struct sinkfd *sinkfd = find_sinkfd_in_apisink(sink, fd);
     if (sinkfd == NULL)
         return -1;
-    close(sinkfd->fd);
-    sinkfd_destroy(sinkfd);
+    posix_sinkfd_close(sinkfd);
     return 0;
 }
 
@@ -331,93 +1162,115 @@ serial_ioctl(struct apisink *sink, int fd, unsigned int cmd, unsigned long arg)
     return 0;
 }
 
-static int serial_send(struct apisink *sink, int fd, const void *buf, size_t len)
-{
-    UNUSED(sink);
-    return write(fd, buf, len);
-}
-
 static int serial_recv(struct apisink *sink, int fd, void *buf, size_t size)
 {
     UNUSED(sink);
     return read(fd, buf, size);
 }
 
-static int serial_poll(struct apisink *sink)
+static apisink_ops_t serial_ops = {
+    .open = serial_open,
+    .close = serial_close,
+    .ioctl = serial_ioctl,
+    .send = posix_send,
+    .recv = serial_recv,
+    .poll = posix_poll,
+    .flush = posix_flush_all,
+    .waitfd = posix_waitfd,
+};
+
+static void posix_sink_init(struct posix_ctx *ctx, struct posix_sink *sink,
+                            const char *name, apisink_ops_t ops)
 {
-    struct posix_sink *unix_sink = container_of(sink, struct posix_sink, sink);
+    apisink_init(&sink->sink, name, ops);
+    sink->ctx = ctx;
+}
 
-    struct timeval tv = { 0, 0 };
-    fd_set recvfds;
-    memcpy(&recvfds, &unix_sink->fds, sizeof(recvfds));
+// each bus gets its own sinks and backend, so buses may run in threads
+int apibus_enable_posix(struct apibus *bus)
+{
+    if (find_apisink_in_apibus(bus, APISINK_UNIX))
+        return -1;
 
-    int nr_recv_fds = select(unix_sink->nfds, &recvfds, NULL, NULL, &tv);
-    if (nr_recv_fds == -1) {
-        if (errno == EINTR)
-            return 0;
-        LOG_ERROR("[select] (%d) %s", errno, strerror(errno));
+    struct posix_ctx *ctx = calloc(1, sizeof(*ctx));
+    if (ctx == NULL)
         return -1;
-    }
+    posix_event_init(&ctx->event);
+    INIT_LIST_HEAD(&ctx->flush_list);
 
-    struct sinkfd *pos, *n;
-    list_for_each_entry_safe(pos, n, &sink->sinkfds, node_sink) {
-        if (nr_recv_fds == 0) break;
+    posix_sink_init(ctx, &ctx->unix_sink, APISINK_UNIX, unix_ops);
+    apibus_add_sink(bus, &ctx->unix_sink.sink);
 
-        if (!FD_ISSET(pos->fd, &recvfds))
-            continue;
+    posix_sink_init(ctx, &ctx->tcp_sink, APISINK_TCP, tcp_ops);
+    apibus_add_sink(bus, &ctx->tcp_sink.sink);
 
-        nr_recv_fds--;
+    posix_sink_init(ctx, &ctx->serial_sink, APISINK_SERIAL, serial_ops);
+    apibus_add_sink(bus, &ctx->serial_sink.sink);
 
-        int nread = read(pos->fd, atbuf_write_pos(pos->rxbuf),
-                         atbuf_spare(pos->rxbuf));
-        if (nread == -1) {
-            LOG_DEBUG("[read] (%d) %s", errno, strerror(errno));
-            sinkfd_destroy(pos);
-        } else if (nread == 0) {
-            LOG_DEBUG("[read] (%d) finished");
-            sinkfd_destroy(pos);
-        } else {
-            atbuf_write_advance(pos->rxbuf, nread);
-            gettimeofday(&pos->ts_poll_recv, NULL);
-        }
-    }
+    posix_sink_init(ctx, &ctx->udp_sink, APISINK_UDP, udp_ops);
+    apibus_add_sink(bus, &ctx->udp_sink.sink);
 
     return 0;
 }
 
-static apisink_ops_t serial_ops = {
-    .open = serial_open,
-    .close = serial_close,
-    .ioctl = serial_ioctl,
-    .send = serial_send,
-    .recv = serial_recv,
-    .poll = serial_poll,
-};
-
-int apibus_enable_posix(struct apibus *bus)
+void apibus_disable_posix(struct apibus *bus)
 {
-    apisink_init(&__unix_sink.sink, APISINK_UNIX, unix_ops);
-    apibus_add_sink(bus, &__unix_sink.sink);
+    struct apisink *sink = find_apisink_in_apibus(bus, APISINK_UNIX);
+    if (sink == NULL)
+        return;
+    struct posix_ctx *ctx = container_of(sink, struct posix_sink, sink)->ctx;
 
-    apisink_init(&__tcp_sink.sink, APISINK_TCP, tcp_ops);
-    apibus_add_sink(bus, &__tcp_sink.sink);
+    apibus_del_sink(bus, &ctx->unix_sink.sink);
+    apisink_fini(&ctx->unix_sink.sink);
 
-    apisink_init(&__serial_sink.sink, APISINK_SERIAL, serial_ops);
-    apibus_add_sink(bus, &__serial_sink.sink);
+    apibus_del_sink(bus, &ctx->tcp_sink.sink);
+    apisink_fini(&ctx->tcp_sink.sink);
 
-    return 0;
+    apibus_del_sink(bus, &ctx->serial_sink.sink);
+    apisink_fini(&ctx->serial_sink.sink);
+
+    // the virtual sinkfds of the peers are freed with them
+    if (ctx->udp) {
+        while (!list_empty(&ctx->udp->peers)) {
+            udp_peer_delete(ctx->udp, list_first_entry(
+                &ctx->udp->peers, struct udp_peer, node));
+        }
+        free(ctx->udp);
+    }
+    apibus_del_sink(bus, &ctx->udp_sink.sink);
+    apisink_fini(&ctx->udp_sink.sink);
+
+    posix_event_fini(&ctx->event);
+    free(ctx);
 }
 
-void apibus_disable_posix(struct apibus *bus)
+int apibus_group_open_tcp(struct apibus_group *group, const char *addr,
+                          int backlog, int *fds)
 {
-    apibus_del_sink(bus, &__unix_sink.sink);
-    apisink_fini(&__unix_sink.sink);
+    if (backlog <= 0)
+        backlog = POSIX_LISTEN_BACKLOG;
+
+    int nshards = apibus_group_size(group);
+    for (int i = 0; i < nshards; i++)
+        fds[i] = -1;
+#if !defined SO_REUSEPORT
+    nshards = 1;
+#endif
 
-    apibus_del_sink(bus, &__tcp_sink.sink);
-    apisink_fini(&__tcp_sink.sink);
+    for (int i = 0; i < nshards; i++) {
+        struct apibus *bus = apibus_group_shard(group, i);
+        struct apisink *sink = find_apisink_in_apibus(bus, APISINK_TCP);
+        fds[i] = sink ? tcp_listen(sink, addr, backlog, nshards > 1) : -1;
+        if (fds[i] == -1) {
+            while (i--) {
+                apibus_close(apibus_group_shard(group, i), fds[i]);
+                fds[i] = -1;
+            }
+            return -1;
+        }
+    }
 
-    apibus_del_sink(bus, &__serial_sink.sink);
-    apisink_fini(&__serial_sink.sink);
+    return 0;
 }
 
 #endif
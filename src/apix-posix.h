@@ -22,6 +22,8 @@ extern "C" {
 #define APISINK_SHM_MEMFD "apisink_shm_memfd"
 #define APISINK_SHM_FTOK  "apisink_shm_ftok"
 
+#define APISINK_IOCTL_BACKLOG 0x5001 // arg: listen backlog of a unix or tcp listener
+
 #define SERIAL_ARG_BAUD_9600 9600
 #define SERIAL_ARG_BAUD_115200 115200
 #define SERIAL_ARG_BITS_7 7
@@ -46,9 +48,28 @@ struct ioctl_serial_param {
 #define apibus_open_serial(bus, addr) \
     apibus_open(bus, APISINK_SERIAL, addr)
 
+/*
+ * Each datagram is one packet. The peers a udp socket hears from get
+ * virtual fds below -1, which the bus sends to and closes like accepted
+ * fds, and which go away after a minute of silence.
+ */
+#define apibus_open_udp(bus, addr) \
+    apibus_open(bus, APISINK_UDP, addr)
+
 int apibus_enable_posix(struct apibus *bus);
 void apibus_disable_posix(struct apibus *bus);
 
+/*
+ * Open a tcp listener on addr for each shard of group, bound with
+ * SO_REUSEPORT so the kernel spreads new connections over the shards
+ * and each accepts its own. Where SO_REUSEPORT is missing, shard 0
+ * listens and hands what it accepts to the others. backlog 0 is
+ * SOMAXCONN. fds[i] is set to the listener of shard i, -1 if none, and
+ * is closed with apibus_close on that shard.
+ */
+int apibus_group_open_tcp(struct apibus_group *group, const char *addr,
+                          int backlog, int *fds);
+
 #ifdef __cplusplus
 }
 #endif
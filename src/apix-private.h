@@ -6,20 +6,41 @@
 #include "apix.h"
 #include "list.h"
 #include "atbuf.h"
+#include "chainbuf.h"
+#include "lfring.h"
+#include "mempool.h"
+#include "ringbuf.h"
 #include "srrp.h"
 
 #define APISINK_NAME_SIZE 64
 #define SINKFD_ADDR_SIZE 64
 #define API_HEADER_SIZE 256
-#define API_TOPIC_SUBSCRIBE_MAX 32
+#define API_TOPIC_CACHE_PACKET_SIZE 256
 
 #define API_REQUEST_ST_NONE 0
 #define API_REQUEST_ST_WAIT_RESPONSE 1
 
 #define API_REQUEST_TIMEOUT 3000 /*ms*/
 #define PARSE_PACKET_TIMEOUT 1000 /*ms*/
+#define API_ACK_TIMEOUT 1000 /*ms*/
+#define API_ACK_WINDOW 16
+#define API_ACK_BACKLOG_MAX 1024
+#define API_ASSEMBLY_SIZE_MAX (1024 * 1024)
+#define API_ASSEMBLY_PER_FD 4
+#define API_ASSEMBLY_TIMEOUT 3000 /*ms*/
 #define APIBUS_IDLE_MAX (1 * 1000 * 1000) /*us*/
 #define APIBUS_STATION_ALIVE_TIMEOUT (600 * 1000) /*ms*/
+#define APIBUS_SINKFD_HASH_SIZE 1021
+#define APIBUS_STATION_HASH_SIZE 1021
+#define APIBUS_REQUEST_HASH_SIZE 1021
+#define APIBUS_TOPIC_HASH_SIZE 4093
+#define APIBUS_SUBSCRIBER_HASH_SIZE 4093
+#define SINKFD_TX_HWM (64 * 1024)
+#define SINKFD_RX_SIZE 4096 // rxbuf starts with and shrinks back to
+#define SINKFD_RX_CAP (256 * 1024) // default rx_cap of a sinkfd
+#define SINKFD_RX_IDLE 1000 /*ms*/
+#define APIBUS_GROUP_SHARDS_MAX 255
+#define APIBUS_GROUP_INBOX_SIZE 4096
 
 #ifdef __cplusplus
 extern "C" {
@@ -38,6 +59,13 @@ typedef struct apisink_ops {
     int (*send)(struct apisink *sink, int fd, const void *buf, size_t len);
     int (*recv)(struct apisink *sink, int fd, void *buf, size_t size);
     int (*poll)(struct apisink *sink);
+    // optional, write out what send queued during this poll
+    int (*flush)(struct apisink *sink);
+    // optional, fd turns readable when poll has work, -1 if not supported
+    int (*waitfd)(struct apisink *sink);
+    // optional, take over a fd accepted by the sink of the same name of
+    // another shard, see apibus_handoff_fd
+    int (*adopt)(struct apisink *sink, int fd);
 } apisink_ops_t;
 
 struct apisink {
@@ -53,6 +81,7 @@ void apisink_fini(struct apisink *sink);
 
 int apibus_add_sink(struct apibus *bus, struct apisink *sink);
 void apibus_del_sink(struct apibus *bus, struct apisink *sink);
+struct apisink *find_apisink_in_apibus(struct apibus *bus, const char *name);
 
 /*
  * sinkfd
@@ -61,21 +90,66 @@ void apibus_del_sink(struct apibus *bus, struct apisink *sink);
 struct sinkfd {
     int fd;
     int listen;
+    int reuseport; // a listener sharing its port with the other shards
     char addr[SINKFD_ADDR_SIZE];
-    atbuf_t *txbuf;
-    atbuf_t *rxbuf;
+    chainbuf_t *txbuf; // output queue, bytes the fd has not taken yet
+    atbuf_t *rxbuf; // grows when full up to rx_cap, see sinkfd_rx_spare
+    size_t rx_cap; // max size of rxbuf, of a listener that of the fds it accepts
+    size_t rx_peak; // high-water mark of rxbuf used
+    size_t tx_hwm;
+    int tx_policy;
+    int tx_blocked; // the fd took no more, wait for it to turn writable
+    int eof; // the peer closed, rxbuf holds the last bytes
+    int framing; // APIBUS_FRAMING_*
+    int rx_framing; // SRRP_FRAMING_* of the last packet parsed
+    int crc16; // packets encoded for the fd carry the crc16 trailer
     struct timeval ts_poll_recv;
+    uint64_t topic_seq; // the last publish sent, see topic_deliver
     struct apisink *sink;
+    void *priv; // owned by the sink
     struct list_head node_sink;
     struct list_head node_bus;
+    struct hlist_node node_hash;
+    struct list_head node_flush; // linked by the sink while txbuf waits for flush
+    struct list_head subscribers; // api_subscriber of this fd
+    uint16_t ack_seqno; // of the next publish in ack mode
+    int ack_inflight;
+    int ack_npending;
+    struct list_head acks_wait; // api_ack_msg sent, not acked yet
+    struct list_head acks_pending; // api_ack_msg held back by the window
+    struct list_head assemblies; // api_assembly in progress
+    int nassemblies;
 };
 
-struct sinkfd *sinkfd_new();
-void sinkfd_destroy();
+/*
+ * sinkfd_new links the new sinkfd into its sink, the bus list and the bus
+ * fd hash, or returns NULL out of memory. sinkfd_destroy unlinks it from
+ * all of them.
+ */
+struct sinkfd *sinkfd_new(struct apisink *sink, int fd);
+void sinkfd_destroy(struct sinkfd *sinkfd);
+
+/*
+ * Sinks recv into atbuf_write_pos(rxbuf) up to sinkfd_rx_spare bytes,
+ * which grows a full rxbuf, and commit them with sinkfd_rx_advance.
+ * 0 spare means the rxbuf is at the cap, wait for the bus to parse it.
+ */
+size_t sinkfd_rx_spare(struct sinkfd *sinkfd);
+void sinkfd_rx_advance(struct sinkfd *sinkfd, size_t len);
+
+// sinks of whole datagrams, grow the rxbuf until len bytes fit or the cap
+size_t sinkfd_rx_reserve(struct sinkfd *sinkfd, size_t len);
 
 struct sinkfd *find_sinkfd_in_apibus(struct apibus *bus, int fd);
 struct sinkfd *find_sinkfd_in_apisink(struct apisink *sink, int fd);
 
+/*
+ * A sink of a bus in an apibus_group passes each fd it accepts here, the
+ * fds are spread over the shards in turn. Return 0 once fd is handed to
+ * another shard, -1 if the sink keeps it.
+ */
+int apibus_handoff_fd(struct apibus *bus, const char *sink, int fd);
+
 /*
  * api_request
  * api_response
@@ -84,17 +158,21 @@ struct sinkfd *find_sinkfd_in_apisink(struct apisink *sink, int fd);
  */
 
 struct api_request {
-    struct srrp_packet *pac;
+    struct srrp_view pac; // borrowed from rxbuf until it is routed
+    char header[SRRP_HEADER_LEN]; // copied for matching the response
+    uint16_t srcid;
     int state;
     uint64_t ts_create;
     uint64_t ts_send;
     int fd;
+    int shard; // of the fd, the bus itself unless handed over by another shard
     uint16_t crc16;
+    struct hlist_node hnode; // bus->request_hash, keyed by srcid & crc16
     struct list_head node;
 };
 
 struct api_response {
-    struct srrp_packet *pac;
+    struct srrp_view pac;
     int fd;
     struct list_head node;
 };
@@ -103,41 +181,109 @@ struct api_station {
     uint16_t sttid;
     uint64_t ts_alive;
     int fd;
-    struct list_head node;
+    struct hlist_node hnode;
+    struct list_head node; // bus->stations is kept ordered by ts_alive
 };
 
 struct api_topic_msg {
-    struct srrp_packet *pac;
+    struct srrp_view pac;
     int fd;
     struct list_head node;
 };
 
 struct api_topic {
-    char header[API_HEADER_SIZE];
-    int fds[API_TOPIC_SUBSCRIBE_MAX];
-    int nfds;
-    struct list_head node;
+    char seg[API_HEADER_SIZE]; // one '/' separated segment of the topic
+    size_t seg_len;
+    struct api_topic *parent;
+    int nchildren;
+    struct list_head subscribers; // api_subscriber of this topic
+    ringbuf_t *cache; // retained packets, see topic_retain
+    int cache_max;
+    int ncached;
+    struct hlist_node hnode; // bus->topic_hash, keyed by parent & seg
+    struct list_head node; // bus->topics, all nodes of the trie
+};
+
+struct api_subscriber {
+    struct api_topic *topic;
+    struct sinkfd *sinkfd;
+    int ack;
+    struct hlist_node hnode; // bus->subscriber_hash, keyed by topic & fd
+    struct list_head node_topic; // topic->subscribers
+    struct list_head node_sinkfd; // sinkfd->subscribers
+};
+
+struct api_assembly {
+    char leader;
+    uint16_t srcid;
+    uint16_t reqcrc16;
+    uint16_t seqno; // of the next fragment
+    char *buf; // header?data so far, null terminated
+    size_t len;
+    size_t size;
+    uint64_t ts_update; /*ms*/
+    struct list_head node; // sinkfd->assemblies, bus->assembled once complete
+};
+
+struct api_ack_msg {
+    struct srrp_packet *pac; // the publish with the seqno of its sinkfd
+    struct sinkfd *sinkfd;
+    uint64_t ts_send; /*ms, 0 while pending*/
+    struct list_head node_sinkfd; // sinkfd->acks_wait or acks_pending
+    struct list_head node; // bus->acks_wait, ordered by ts_send
+};
+
+/*
+ * An apibus_group runs nshards buses, each owning the fds it polls. A
+ * station is attached to the shard its fd is on, group->stations maps
+ * each sttid to that shard. What a shard can not deliver to its own fds
+ * is copied into an api_handoff and pushed to the inbox of the shard
+ * that can, which is woken through its wakefd.
+ */
+
+struct task;
+
+struct apibus_group {
+    int nshards;
+    struct apibus **shards;
+    uint8_t stations[UINT16_MAX + 1]; // shard + 1 of each sttid, 0 if none
+    unsigned int next_shard; // for apibus_handoff_fd
+    struct task **tasks; // see apibus_group_start
 };
 
-#define api_request_delete(req) \
+#define API_HANDOFF_REQUEST 1 // route pac to the station dstid
+#define API_HANDOFF_RESPONSE 2 // send pac to fd
+#define API_HANDOFF_PUBLISH 3 // deliver pac to the subscribers of the shard
+#define API_HANDOFF_SEND 4 // send buf to fd
+#define API_HANDOFF_ADOPT 5 // take over fd accepted by the sink named in buf
+
+struct api_handoff {
+    int type;
+    int shard; // the sender
+    int fd;
+    uint16_t dstid;
+    struct srrp_view pac; // points into buf
+    size_t len;
+    char buf[0];
+};
+
+#define api_request_delete(bus, req) \
 { \
+    hlist_del_init(&req->hnode); \
     list_del(&req->node); \
-    srrp_free(req->pac); \
-    free(req); \
+    mempool_free(bus->request_pool, req); \
 }
 
-#define api_response_delete(resp) \
+#define api_response_delete(bus, resp) \
 { \
     list_del(&resp->node); \
-    srrp_free(resp->pac); \
-    free(resp); \
+    mempool_free(bus->response_pool, resp); \
 }
 
-#define api_topic_msg_delete(tmsg) \
+#define api_topic_msg_delete(bus, tmsg) \
 { \
     list_del(&tmsg->node); \
-    srrp_free(tmsg->pac); \
-    free(tmsg); \
+    mempool_free(bus->topic_msg_pool, tmsg); \
 }
 
 /*
@@ -145,18 +291,58 @@ struct api_topic {
  */
 
 struct apibus {
-    struct list_head requests;
+    struct list_head requests; // parsed, not routed yet
+    struct list_head requests_wait; // routed, ordered by ts_send
+    struct hlist_head request_hash[APIBUS_REQUEST_HASH_SIZE];
     struct list_head responses;
     struct list_head stations;
+    struct hlist_head station_hash[APIBUS_STATION_HASH_SIZE];
     struct list_head topic_msgs;
+    struct list_head acks_wait;
+    struct list_head assembled;
     struct list_head topics;
+    struct hlist_head topic_hash[APIBUS_TOPIC_HASH_SIZE];
+    struct api_topic *topic_root;
+    struct hlist_head subscriber_hash[APIBUS_SUBSCRIBER_HASH_SIZE];
+    uint64_t topic_seq;
     struct list_head sinkfds;
+    struct hlist_head sinkfd_hash[APIBUS_SINKFD_HASH_SIZE];
     struct list_head sinks;
+    mempool_t *request_pool;
+    mempool_t *response_pool;
+    mempool_t *topic_msg_pool;
+    mempool_t *station_pool;
+    mempool_t *topic_pool;
+    mempool_t *subscriber_pool;
+    mempool_t *ack_pool;
+    mempool_t *assembly_pool;
+    uint64_t tx_drops;
+    uint64_t tx_packets;
+    uint64_t tx_syscalls;
+    uint64_t ack_redeliveries;
+    uint64_t ack_stalls;
+    uint64_t ack_drops;
+    uint64_t translations;
+    uint64_t rx_grows;
+    uint64_t rx_shrinks;
     struct timeval poll_ts;
     int poll_cnt;
     uint64_t idle_usec;
+    uint64_t parse_deadline; /*ms*/
+    int stop;
+    struct apibus_group *group; // NULL unless created by apibus_group_new
+    int shard; // index in group
+    mpsc_ring_t *inbox; // api_handoff from the other shards
+    int wakefd[2]; // a pipe, readable once the inbox is fed
+    int wake_pending;
+    uint64_t handoffs;
+    uint64_t handoff_drops;
+    uint64_t pool_drops;
 };
 
+// wake the bus blocked in its poll, safe from any thread
+void apibus_wake(struct apibus *bus);
+
 #ifdef __cplusplus
 }
 #endif
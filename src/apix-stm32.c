@@ -28,12 +28,12 @@ static int serial_open(struct apisink *sink, const char *addr)
     int fd = open(addr, O_RDWR | O_NOCTTY);
     if (fd == -1) return -1;
 
-    struct sinkfd *sinkfd = sinkfd_new();
-    sinkfd->fd = fd;
+    struct sinkfd *sinkfd = sinkfd_new(sink, fd);
+    if (sinkfd == NULL) {
+        close(fd);
+        return -1;
+    }
     snprintf(sinkfd->addr, sizeof(sinkfd->addr), "%s", addr);
-    sinkfd->sink = sink;
-    list_add(&sinkfd->node_sink, &sink->sinkfds);
-    list_add(&sinkfd->node_bus, &sink->bus->sinkfds);
 
     return fd;
 }
@@ -72,13 +72,15 @@ static int serial_poll(struct apisink *sink)
 {
     struct sinkfd *pos;
     list_for_each_entry(pos, &sink->sinkfds, node_sink) {
-        int nr = read(pos->fd, atbuf_write_pos(pos->rxbuf), atbuf_spare(pos->rxbuf));
+        size_t spare = sinkfd_rx_spare(pos);
+        if (spare == 0) continue;
+        int nr = read(pos->fd, atbuf_write_pos(pos->rxbuf), spare);
         if (nr == 0) continue;
         if (nr == -1) {
             LOG_ERROR("poll failed!");
             continue;
         }
-        atbuf_write_advance(pos->rxbuf, nr);
+        sinkfd_rx_advance(pos, nr);
     }
     return 0;
 }
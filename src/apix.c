@@ -6,74 +6,464 @@
 #include <time.h>
 #include <unistd.h>
 #include <sys/time.h>
+#if defined __unix__ || defined __linux__ || defined __APPLE__
+#include <fcntl.h>
+#include <poll.h>
+#endif
 
 #include "apix-private.h"
 #include "stddefx.h"
 #include "crc16.h"
 #include "list.h"
 #include "atbuf.h"
+#include "ringbuf.h"
 #include "log.h"
 #include "srrp.h"
 #include "json.h"
 
-static void parse_packet(struct apibus *bus, struct sinkfd *sinkfd)
+static uint64_t timeval_ms(const struct timeval *tv)
 {
-    while (atbuf_used(sinkfd->rxbuf)) {
-        struct srrp_packet *pac = srrp_read_one_packet(atbuf_read_pos(sinkfd->rxbuf));
-        if (pac == NULL) {
-            if (time(0) < sinkfd->ts_poll_recv.tv_sec + PARSE_PACKET_TIMEOUT / 1000)
-                break;
+    return (uint64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+static uint64_t apibus_now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return timeval_ms(&tv);
+}
+
+/*
+ * Fragments written by srrp_write_stream are reassembled per fd, leader
+ * and srcid. An assembly is bounded by API_ASSEMBLY_SIZE_MAX, a fd keeps
+ * at most API_ASSEMBLY_PER_FD of them, and one not fed for
+ * API_ASSEMBLY_TIMEOUT is dropped. Once complete it moves to
+ * bus->assembled, where it backs the view of the message until the
+ * msgs of the poll are handled.
+ */
+
+static void assembly_delete(struct apibus *bus, struct api_assembly *asb)
+{
+    list_del(&asb->node);
+    free(asb->buf);
+    mempool_free(bus->assembly_pool, asb);
+}
+
+static struct api_assembly *
+find_assembly(struct sinkfd *sinkfd, char leader, uint16_t srcid)
+{
+    struct api_assembly *pos;
+    list_for_each_entry(pos, &sinkfd->assemblies, node) {
+        if (pos->leader == leader && pos->srcid == srcid)
+            return pos;
+    }
+    return NULL;
+}
+
+static void drop_assembly(struct apibus *bus, struct sinkfd *sinkfd,
+                          struct api_assembly *asb, const char *reason)
+{
+    LOG_WARN("drop assembly %c%.4x from #%d: %s",
+             asb->leader, asb->srcid, sinkfd->fd, reason);
+    assembly_delete(bus, asb);
+    sinkfd->nassemblies--;
+}
+
+static void expire_assembly(struct apibus *bus, struct sinkfd *sinkfd)
+{
+    uint64_t now = apibus_now();
+    struct api_assembly *pos, *n;
+    list_for_each_entry_safe(pos, n, &sinkfd->assemblies, node) {
+        if (now >= pos->ts_update + API_ASSEMBLY_TIMEOUT)
+            drop_assembly(bus, sinkfd, pos, "timeout");
+    }
+}
+
+/*
+ * Feed pac to the assembly it belongs to, return 1 with pac turned into
+ * a view of the whole message once its last fragment is in, 0 otherwise.
+ */
+static int
+assemble_packet(struct apibus *bus, struct sinkfd *sinkfd, struct srrp_view *pac)
+{
+    struct api_assembly *asb = find_assembly(sinkfd, pac->leader, pac->srcid);
+
+    if (pac->seat == SRRP_BEGIN_PACKET) {
+        if (asb)
+            drop_assembly(bus, sinkfd, asb, "restarted");
+        if (sinkfd->nassemblies == API_ASSEMBLY_PER_FD) {
+            drop_assembly(bus, sinkfd, list_first_entry(
+                              &sinkfd->assemblies, struct api_assembly, node),
+                          "too many");
+        }
+        asb = mempool_alloc(bus->assembly_pool);
+        if (asb == NULL) {
+            bus->pool_drops++;
+            LOG_DEBUG("drop fragment %c%x from #%d, no assembly", pac->leader,
+                      pac->seqno, sinkfd->fd);
+            return 0;
+        }
+        memset(asb, 0, sizeof(*asb));
+        asb->leader = pac->leader;
+        asb->srcid = pac->srcid;
+        asb->reqcrc16 = pac->reqcrc16;
+        asb->seqno = pac->seqno;
+        list_add_tail(&asb->node, &sinkfd->assemblies);
+        sinkfd->nassemblies++;
+    } else if (asb == NULL) {
+        LOG_DEBUG("drop fragment %c%x from #%d", pac->leader, pac->seqno,
+                  sinkfd->fd);
+        return 0;
+    } else if (asb->seqno != pac->seqno) {
+        drop_assembly(bus, sinkfd, asb, "out of order");
+        return 0;
+    }
+
+    // a last fragment may parse as header?data on its own, take it whole
+    const char *body = pac->header ? pac->header : pac->data;
+    size_t body_len = pac->data + pac->data_len - body;
+
+    if (asb->len + body_len >= API_ASSEMBLY_SIZE_MAX) {
+        drop_assembly(bus, sinkfd, asb, "too large");
+        return 0;
+    }
+    if (asb->len + body_len + 1 > asb->size) {
+        size_t size = asb->size ? asb->size : SRRP_LENGTH_MAX;
+        while (size < asb->len + body_len + 1)
+            size <<= 1;
+        char *buf = realloc(asb->buf, size);
+        if (buf == NULL) {
+            bus->pool_drops++;
+            drop_assembly(bus, sinkfd, asb, "out of memory");
+            return 0;
+        }
+        asb->buf = buf;
+        asb->size = size;
+    }
+    memcpy(asb->buf + asb->len, body, body_len);
+    asb->len += body_len;
+    asb->buf[asb->len] = 0;
+    asb->seqno = pac->seqno + 1;
+    asb->ts_update = apibus_now();
+
+    if (pac->seat != SRRP_END_PACKET)
+        return 0;
+
+    struct srrp_view view = {0};
+    view.leader = asb->leader;
+    view.seat = SRRP_END_PACKET;
+    view.srcid = asb->srcid;
+    view.reqcrc16 = asb->reqcrc16;
+    if (srrp_parse_body(&view, asb->buf, asb->len) != 0) {
+        drop_assembly(bus, sinkfd, asb, "bad body");
+        return 0;
+    }
+
+    // no raw packet stands for the whole message, see apibus_send_view
+    view.raw = NULL;
+    view.len = 0;
+    *pac = view;
+    list_move_tail(&asb->node, &bus->assembled);
+    sinkfd->nassemblies--;
+    return 1;
+}
+
+static struct api_request *
+request_new(struct apibus *bus, struct srrp_view *pac, int shard, int fd)
+{
+    struct api_request *req = mempool_alloc(bus->request_pool);
+    if (req == NULL) {
+        bus->pool_drops++;
+        LOG_DEBUG("drop request %.4x from #%d, pool exhausted", pac->srcid, fd);
+        return NULL;
+    }
+    memset(req, 0, sizeof(*req));
+    req->pac = *pac;
+    req->srcid = pac->srcid;
+    req->state = API_REQUEST_ST_NONE;
+    req->ts_create = time(0);
+    req->ts_send = 0;
+    req->fd = fd;
+    req->shard = shard;
+    req->crc16 = crc16(pac->header, pac->header_len);
+    req->crc16 = crc16_crc(req->crc16, pac->data, pac->data_len);
+    INIT_HLIST_NODE(&req->hnode);
+    INIT_LIST_HEAD(&req->node);
+    return req;
+}
+
+/*
+ * Parse rxbuf into views without consuming it, the caller handles the
+ * queued msgs and then advances rxbuf by the returned length.
+ */
+static size_t parse_packet(struct apibus *bus, struct sinkfd *sinkfd)
+{
+    const char *buf = atbuf_read_pos(sinkfd->rxbuf);
+    size_t len = atbuf_used(sinkfd->rxbuf);
+    size_t offset = 0;
 
-            LOG_WARN("parse packet failed: %s", atbuf_read_pos(sinkfd->rxbuf));
-            int offset = srrp_next_packet_offset(atbuf_read_pos(sinkfd->rxbuf));
-            if (offset == -1 || offset == 0)
-                atbuf_read_advance(sinkfd->rxbuf, atbuf_used(sinkfd->rxbuf));
-            else {
-                assert((size_t)offset < atbuf_used(sinkfd->rxbuf));
-                atbuf_read_advance(sinkfd->rxbuf, offset);
+    while (offset < len) {
+        struct srrp_view pac;
+        size_t consumed = 0;
+        if (srrp_parse_view(&pac, buf + offset, len - offset, &consumed) != 0) {
+            if (consumed == 0) {
+                // incomplete, wait for the rest until PARSE_PACKET_TIMEOUT
+                if (!sinkfd->eof &&
+                    time(0) < sinkfd->ts_poll_recv.tv_sec + PARSE_PACKET_TIMEOUT / 1000)
+                    break;
+                // then drop its leader and resync, or all of it at eof
+                consumed = sinkfd->eof ? len - offset : 1;
             }
-            break;
+            LOG_WARN("parse packet failed, drop %d bytes: %.*s", (int)consumed,
+                     (int)consumed, buf + offset);
+            offset += consumed;
+            continue;
         }
 
-        if (pac->leader == SRRP_REQUEST_LEADER) {
-            struct api_request *req = malloc(sizeof(*req));
-            memset(req, 0, sizeof(*req));
-            req->pac = pac;
-            req->state = API_REQUEST_ST_NONE;
-            req->ts_create = time(0);
-            req->ts_send = 0;
-            req->fd = sinkfd->fd;
-            req->crc16 = crc16(pac->header, pac->header_len);
-            req->crc16 = crc16_crc(req->crc16, pac->data, pac->data_len);
-            INIT_LIST_HEAD(&req->node);
-            list_add(&req->node, &bus->requests);
-        } else if (pac->leader == SRRP_RESPONSE_LEADER) {
-            struct api_response *resp = malloc(sizeof(*resp));
+        offset += consumed;
+        sinkfd->rx_framing = srrp_view_framing(&pac);
+
+        // a fragment, a complete '$' one may close an assembly as well
+        if ((pac.header == NULL ||
+             (pac.seqno != 0 && find_assembly(sinkfd, pac.leader, pac.srcid))) &&
+            assemble_packet(bus, sinkfd, &pac) == 0)
+            continue;
+
+        if (pac.leader == SRRP_REQUEST_LEADER) {
+            struct api_request *req =
+                request_new(bus, &pac, bus->shard, sinkfd->fd);
+            if (req)
+                list_add_tail(&req->node, &bus->requests);
+        } else if (pac.leader == SRRP_RESPONSE_LEADER) {
+            struct api_response *resp = mempool_alloc(bus->response_pool);
+            if (resp == NULL) {
+                bus->pool_drops++;
+                continue;
+            }
             memset(resp, 0, sizeof(*resp));
             resp->pac = pac;
             resp->fd = sinkfd->fd;
             INIT_LIST_HEAD(&resp->node);
-            list_add(&resp->node, &bus->responses);
-        } else if (pac->leader == SRRP_SUBSCRIBE_LEADER ||
-                   pac->leader == SRRP_UNSUBSCRIBE_LEADER ||
-                   pac->leader == SRRP_PUBLISH_LEADER) {
-            struct api_topic_msg *tmsg = malloc(sizeof(*tmsg));
+            list_add_tail(&resp->node, &bus->responses);
+        } else if (pac.leader == SRRP_SUBSCRIBE_LEADER ||
+                   pac.leader == SRRP_UNSUBSCRIBE_LEADER ||
+                   pac.leader == SRRP_PUBLISH_LEADER ||
+                   pac.leader == SRRP_ACK_LEADER) {
+            struct api_topic_msg *tmsg = mempool_alloc(bus->topic_msg_pool);
+            if (tmsg == NULL) {
+                bus->pool_drops++;
+                continue;
+            }
             memset(tmsg, 0, sizeof(*tmsg));
             tmsg->pac = pac;
             tmsg->fd = sinkfd->fd;
             INIT_LIST_HEAD(&tmsg->node);
-            list_add(&tmsg->node, &bus->topic_msgs);
+            list_add_tail(&tmsg->node, &bus->topic_msgs);
+        }
+    }
+
+    return offset;
+}
+
+struct send_view_arg {
+    struct apibus *bus;
+    int fd;
+};
+
+static int send_view_emit(const char *raw, size_t len, void *arg)
+{
+    struct send_view_arg *sva = arg;
+    return apibus_send(sva->bus, sva->fd, raw, len) == (int)len ? 0 : -1;
+}
+
+static int sinkfd_framing(struct sinkfd *sinkfd)
+{
+    if (sinkfd->framing == APIBUS_FRAMING_AUTO)
+        return sinkfd->rx_framing;
+    return sinkfd->framing == APIBUS_FRAMING_BINARY ?
+        SRRP_FRAMING_BINARY : SRRP_FRAMING_TEXT;
+}
+
+// what packets the bus encodes for the fd are written with
+static int sinkfd_encoding(struct sinkfd *sinkfd)
+{
+    return sinkfd_framing(sinkfd) | (sinkfd->crc16 ? SRRP_FRAMING_CRC16 : 0);
+}
+
+/*
+ * Send pac in the framing of fd. A packet of the other framing is
+ * translated, a reassembled message has no raw packet and is streamed
+ * as fragments.
+ */
+static int apibus_send_view(struct apibus *bus, int fd, struct srrp_view *pac)
+{
+    struct sinkfd *sinkfd = find_sinkfd_in_apibus(bus, fd);
+    if (sinkfd == NULL)
+        return -1;
+
+    int framing = sinkfd_framing(sinkfd);
+    if (pac->raw && srrp_view_framing(pac) == framing)
+        return apibus_send(bus, fd, pac->raw, pac->len);
+
+    if (pac->raw) {
+        char raw[SRRP_LENGTH_MAX];
+        int len = srrp_write_view(raw, sizeof(raw), pac, sinkfd_encoding(sinkfd));
+        if (len != -1) {
+            bus->translations++;
+            return apibus_send(bus, fd, raw, len);
+        }
+        // too large for the other framing, only a single packet is cut again
+        if (pac->header == NULL || pac->seqno != 0) {
+            LOG_WARN("drop untranslatable packet %c%x to #%d",
+                     pac->leader, pac->seqno, fd);
+            return -1;
         }
+        bus->translations++;
+    }
+
+    char header[SRRP_HEADER_LEN];
+    snprintf(header, sizeof(header), "%.*s", (int)pac->header_len, pac->header);
+    struct send_view_arg sva = { bus, fd };
+    return srrp_write_stream_framing(sinkfd_encoding(sinkfd), pac->leader, pac->srcid,
+                                     pac->reqcrc16, header, pac->data,
+                                     send_view_emit, &sva);
+}
+
+/*
+ * Handoffs between the shards of a group, see struct apibus_group. A
+ * handoff is a copy, the view it carries stays valid until the receiving
+ * shard frees it.
+ */
+
+static struct api_handoff *
+handoff_new(struct apibus *bus, int type, int fd, const void *buf, size_t len)
+{
+    struct api_handoff *h = malloc(sizeof(*h) + len);
+    if (h == NULL)
+        return NULL;
+    memset(h, 0, sizeof(*h));
+    h->type = type;
+    h->shard = bus->shard;
+    h->fd = fd;
+    h->len = len;
+    if (buf)
+        memcpy(h->buf, buf, len);
+    return h;
+}
+
+// the raw packet is copied, a reassembled message as header\0data\0
+static struct api_handoff *
+handoff_new_view(struct apibus *bus, int type, int fd, const struct srrp_view *pac)
+{
+    struct api_handoff *h;
+
+    if (pac->raw) {
+        h = handoff_new(bus, type, fd, pac->raw, pac->len);
+        if (h == NULL)
+            return NULL;
+        h->pac = *pac;
+        h->pac.raw = h->buf;
+        if (pac->header)
+            h->pac.header = h->buf + (pac->header - pac->raw);
+        if (pac->data)
+            h->pac.data = h->buf + (pac->data - pac->raw);
+        return h;
+    }
+
+    h = handoff_new(bus, type, fd, NULL, pac->header_len + pac->data_len + 2);
+    if (h == NULL)
+        return NULL;
+    h->pac = *pac;
+    memcpy(h->buf, pac->header, pac->header_len);
+    h->buf[pac->header_len] = 0;
+    h->pac.header = h->buf;
+    memcpy(h->buf + pac->header_len + 1, pac->data, pac->data_len);
+    h->buf[pac->header_len + 1 + pac->data_len] = 0;
+    h->pac.data = h->buf + pac->header_len + 1;
+    return h;
+}
+
+// push h to the inbox of shard, h is freed if it does not fit
+static int handoff_post(struct apibus *bus, int shard, struct api_handoff *h)
+{
+    struct apibus *dst = bus->group->shards[shard];
+    if (h == NULL || mpsc_ring_push(dst->inbox, h) != 0) {
+        LOG_WARN("drop handoff to shard %d", shard);
+        bus->handoff_drops++;
+        free(h);
+        return -1;
+    }
+
+    bus->handoffs++;
+    apibus_wake(dst);
+    return 0;
+}
 
-        atbuf_read_advance(sinkfd->rxbuf, pac->len);
+void apibus_wake(struct apibus *bus)
+{
+#if defined __unix__ || defined __linux__ || defined __APPLE__
+    // one byte is enough until the bus drains the pipe again
+    if (bus->wakefd[1] != -1 &&
+        __atomic_exchange_n(&bus->wake_pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        char c = 0;
+        if (write(bus->wakefd[1], &c, 1) == -1 && errno != EAGAIN)
+            LOG_ERROR("[wake] (%d) %s", errno, strerror(errno));
+    }
+#else
+    UNUSED(bus);
+#endif
+}
+
+// send buf to fd of shard, which is the bus itself unless in a group
+static int
+apibus_reply(struct apibus *bus, int shard, int fd, const void *buf, size_t len)
+{
+    if (shard == bus->shard)
+        return apibus_send(bus, fd, buf, len);
+    return handoff_post(bus, shard, handoff_new(
+                            bus, API_HANDOFF_SEND, fd, buf, len));
+}
+
+int apibus_handoff_fd(struct apibus *bus, const char *sink, int fd)
+{
+    if (bus == NULL || bus->group == NULL)
+        return -1;
+
+    int shard = __atomic_fetch_add(&bus->group->next_shard, 1, __ATOMIC_RELAXED)
+        % bus->group->nshards;
+    if (shard == bus->shard)
+        return -1;
+    return handoff_post(bus, shard, handoff_new(
+                            bus, API_HANDOFF_ADOPT, fd, sink, strlen(sink) + 1));
+}
+
+#define request_hash_fn(srcid, crc) \
+    ((((uint32_t)(srcid) << 16) | (crc)) % APIBUS_REQUEST_HASH_SIZE)
+
+static struct api_request *
+find_request(struct apibus *bus, struct srrp_view *resp)
+{
+    struct hlist_head *head =
+        &bus->request_hash[request_hash_fn(resp->srcid, resp->reqcrc16)];
+    struct api_request *pos;
+    hlist_for_each_entry(pos, head, hnode) {
+        if (pos->crc16 == resp->reqcrc16 &&
+            pos->srcid == resp->srcid &&
+            strlen(pos->header) == resp->header_len &&
+            memcmp(pos->header, resp->header, resp->header_len) == 0) {
+            return pos;
+        }
     }
+    return NULL;
 }
 
+#define station_hash_fn(sttid) ((sttid) % APIBUS_STATION_HASH_SIZE)
+
 static struct api_station *
-find_station(struct list_head *stations, uint16_t sttid)
+find_station(struct apibus *bus, uint16_t sttid)
 {
     struct api_station *pos;
-    list_for_each_entry(pos, stations, node) {
+    hlist_for_each_entry(pos, &bus->station_hash[station_hash_fn(sttid)], hnode) {
         if (pos->sttid == sttid) {
             return pos;
         }
@@ -81,95 +471,634 @@ find_station(struct list_head *stations, uint16_t sttid)
     return NULL;
 }
 
+// the shard of the group sttid is attached to, -1 if none
+static int station_shard(struct apibus *bus, uint16_t sttid)
+{
+    if (bus->group == NULL)
+        return bus->shard;
+    return __atomic_load_n(&bus->group->stations[sttid], __ATOMIC_RELAXED) - 1;
+}
+
+// a station that moved to this shard is taken from the one it was on
+static void claim_station(struct apibus *bus, uint16_t sttid)
+{
+    if (bus->group && station_shard(bus, sttid) != bus->shard)
+        __atomic_store_n(&bus->group->stations[sttid], bus->shard + 1,
+                         __ATOMIC_RELAXED);
+}
+
+static void release_station(struct apibus *bus, uint16_t sttid)
+{
+    uint8_t shard = bus->shard + 1;
+    if (bus->group)
+        __atomic_compare_exchange_n(&bus->group->stations[sttid], &shard, 0, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/*
+ * All stations share the same alive timeout, so moving a refreshed station
+ * to the tail keeps bus->stations in expiry order.
+ */
+static void touch_station(struct apibus *bus, struct api_station *stt)
+{
+    stt->ts_alive = time(0);
+    list_move_tail(&stt->node, &bus->stations);
+    claim_station(bus, stt->sttid);
+}
+
+/*
+ * Topics are split on '/' into segments and kept as a trie. Children are
+ * found through bus->topic_hash keyed by parent & segment, so matching a
+ * publish costs O(depth) whatever the number of topics. In a subscribe
+ * header a '+' segment matches any one segment, and a trailing '#'
+ * matches the remaining segments, none included.
+ */
+
+#define topic_hash_fn(parent, seg, len) \
+    (((uintptr_t)(parent) / sizeof(void *) ^ crc16(seg, len)) \
+     % APIBUS_TOPIC_HASH_SIZE)
+
+// returns the start of the next segment, NULL after the last one
+static const char *
+topic_next_seg(const char *topic, const char *end, size_t *len)
+{
+    const char *slash = memchr(topic, '/', end - topic);
+    *len = (slash ? slash : end) - topic;
+    return slash ? slash + 1 : NULL;
+}
+
+static int topic_is_wildcard(const char *seg, size_t len, char c)
+{
+    return len == 1 && seg[0] == c;
+}
+
+static int topic_filter_is_valid(const char *header, size_t len)
+{
+    const char *p = header, *end = header + len;
+    while (p) {
+        size_t seg_len;
+        const char *seg = p;
+        p = topic_next_seg(p, end, &seg_len);
+        if (memchr(seg, '+', seg_len) && !topic_is_wildcard(seg, seg_len, '+'))
+            return 0;
+        if (memchr(seg, '#', seg_len) && (seg_len != 1 || p != NULL))
+            return 0;
+    }
+    return 1;
+}
+
 static struct api_topic *
-find_topic(struct list_head *topics, const void *header, size_t len)
+find_topic_child(struct apibus *bus, struct api_topic *parent,
+                 const char *seg, size_t len)
 {
+    if (parent->nchildren == 0)
+        return NULL;
+
     struct api_topic *pos;
-    list_for_each_entry(pos, topics, node) {
-        if (memcmp(pos->header, header, len) == 0) {
+    hlist_for_each_entry(
+        pos, &bus->topic_hash[topic_hash_fn(parent, seg, len)], hnode) {
+        if (pos->parent == parent && pos->seg_len == len &&
+            memcmp(pos->seg, seg, len) == 0) {
             return pos;
         }
     }
     return NULL;
 }
 
+static struct api_topic *
+add_topic(struct apibus *bus, struct api_topic *parent, const char *seg, size_t len)
+{
+    struct api_topic *topic = mempool_alloc(bus->topic_pool);
+    if (topic == NULL)
+        return NULL;
+    memset(topic, 0, sizeof(*topic));
+    memcpy(topic->seg, seg, len);
+    topic->seg_len = len;
+    topic->parent = parent;
+    INIT_LIST_HEAD(&topic->subscribers);
+    INIT_HLIST_NODE(&topic->hnode);
+    INIT_LIST_HEAD(&topic->node);
+    // the root's nchildren is read by the other shards, see topic_pub_handler
+    if (parent) {
+        __atomic_add_fetch(&parent->nchildren, 1, __ATOMIC_RELAXED);
+        hlist_add_head(&topic->hnode,
+                       &bus->topic_hash[topic_hash_fn(parent, seg, len)]);
+    }
+    list_add(&topic->node, &bus->topics);
+    return topic;
+}
+
+// free the nodes left without subscribers and children, up to the root
+static void prune_topic(struct apibus *bus, struct api_topic *topic)
+{
+    while (topic != bus->topic_root && list_empty(&topic->subscribers) &&
+           topic->nchildren == 0 && topic->cache == NULL) {
+        struct api_topic *parent = topic->parent;
+        __atomic_sub_fetch(&parent->nchildren, 1, __ATOMIC_RELAXED);
+        hlist_del_init(&topic->hnode);
+        list_del_init(&topic->node);
+        mempool_free(bus->topic_pool, topic);
+        topic = parent;
+    }
+}
+
+// walk the trie along header, missing nodes are added if create is set
+static struct api_topic *
+find_topic(struct apibus *bus, const char *header, size_t len, int create)
+{
+    struct api_topic *topic = bus->topic_root;
+    const char *p = header, *end = header + len;
+    while (p) {
+        size_t seg_len;
+        const char *seg = p;
+        p = topic_next_seg(p, end, &seg_len);
+        struct api_topic *child = find_topic_child(bus, topic, seg, seg_len);
+        if (child == NULL) {
+            if (!create)
+                return NULL;
+            child = add_topic(bus, topic, seg, seg_len);
+            if (child == NULL) {
+                // the nodes added so far have nothing to hold them
+                prune_topic(bus, topic);
+                return NULL;
+            }
+        }
+        topic = child;
+    }
+    return topic;
+}
+
 static void clear_unalive_station(struct apibus *bus)
 {
+    time_t now = time(0);
     struct api_station *pos, *n;
     list_for_each_entry_safe(pos, n, &bus->stations, node) {
-        if (time(0) > pos->ts_alive + APIBUS_STATION_ALIVE_TIMEOUT / 1000) {
-            LOG_DEBUG("clear unalive station: %x", pos->sttid);
-            list_del(&pos->node);
-            free(pos);
-        }
+        if (now <= pos->ts_alive + APIBUS_STATION_ALIVE_TIMEOUT / 1000)
+            break;
+        LOG_DEBUG("clear unalive station: %x", pos->sttid);
+        release_station(bus, pos->sttid);
+        hlist_del_init(&pos->hnode);
+        list_del(&pos->node);
+        mempool_free(bus->station_pool, pos);
     }
 }
 
 static void add_station(struct apibus *bus, struct api_request *req)
 {
-    struct api_station *stt = malloc(sizeof(*stt));
+    struct api_station *stt = mempool_alloc(bus->station_pool);
+    if (stt == NULL) {
+        // the request is still routed, its next one adds the station again
+        bus->pool_drops++;
+        return;
+    }
     memset(stt, 0, sizeof(*stt));
-    stt->sttid = req->pac->srcid;
+    stt->sttid = req->srcid;
     stt->ts_alive = time(0);
     stt->fd = req->fd;
+    INIT_HLIST_NODE(&stt->hnode);
     INIT_LIST_HEAD(&stt->node);
-    list_add(&stt->node, &bus->stations);
+    hlist_add_head(&stt->hnode, &bus->station_hash[station_hash_fn(stt->sttid)]);
+    list_add_tail(&stt->node, &bus->stations);
+    claim_station(bus, stt->sttid);
 }
 
-static void topic_sub_handler(struct apibus *bus, struct api_topic_msg *tmsg)
+/*
+ * A subscriber links a topic and a sinkfd. bus->subscriber_hash keyed by
+ * topic & fd keeps each pair unique, and the sinkfd keeps its own list so
+ * its subscriptions go away with it.
+ */
+
+#define subscriber_hash_fn(topic, fd) \
+    (((uintptr_t)(topic) / sizeof(void *) ^ (unsigned int)(fd)) \
+     % APIBUS_SUBSCRIBER_HASH_SIZE)
+
+static struct api_subscriber *
+find_subscriber(struct apibus *bus, struct api_topic *topic, int fd)
 {
-    struct api_topic *topic = NULL;
-    struct api_topic *pos;
-    list_for_each_entry(pos, &bus->topics, node) {
-        if (memcmp(topic->header, tmsg->pac->header, strlen(topic->header)) == 0) {
-            topic = pos;
+    struct api_subscriber *pos;
+    hlist_for_each_entry(
+        pos, &bus->subscriber_hash[subscriber_hash_fn(topic, fd)], hnode) {
+        if (pos->topic == topic && pos->sinkfd->fd == fd)
+            return pos;
+    }
+    return NULL;
+}
+
+static struct api_subscriber *
+add_subscriber(struct apibus *bus, struct api_topic *topic, struct sinkfd *sinkfd)
+{
+    struct api_subscriber *sub = mempool_alloc(bus->subscriber_pool);
+    if (sub == NULL)
+        return NULL;
+    sub->topic = topic;
+    sub->sinkfd = sinkfd;
+    sub->ack = 0;
+    INIT_HLIST_NODE(&sub->hnode);
+    hlist_add_head(&sub->hnode,
+                   &bus->subscriber_hash[subscriber_hash_fn(topic, sinkfd->fd)]);
+    list_add_tail(&sub->node_topic, &topic->subscribers);
+    list_add_tail(&sub->node_sinkfd, &sinkfd->subscribers);
+    return sub;
+}
+
+static void del_subscriber(struct apibus *bus, struct api_subscriber *sub)
+{
+    hlist_del_init(&sub->hnode);
+    list_del(&sub->node_topic);
+    list_del(&sub->node_sinkfd);
+    mempool_free(bus->subscriber_pool, sub);
+}
+
+/*
+ * A subscribe with {ack:1} asks for at-least-once delivery. Publishes to
+ * the fd then carry its own seqno and stay in sinkfd->acks_wait until
+ * the fd sends back an ack with that seqno, they are sent again every
+ * API_ACK_TIMEOUT meanwhile. At most API_ACK_WINDOW are in flight per fd,
+ * the rest wait in sinkfd->acks_pending, up to API_ACK_BACKLOG_MAX.
+ */
+
+static void ack_msg_delete(struct apibus *bus, struct api_ack_msg *msg)
+{
+    if (msg->ts_send)
+        msg->sinkfd->ack_inflight--;
+    else
+        msg->sinkfd->ack_npending--;
+    list_del(&msg->node_sinkfd);
+    list_del_init(&msg->node);
+    srrp_free(msg->pac);
+    mempool_free(bus->ack_pool, msg);
+}
+
+static void ack_send(struct apibus *bus, struct api_ack_msg *msg)
+{
+    struct sinkfd *sinkfd = msg->sinkfd;
+    sinkfd->ack_npending--;
+    sinkfd->ack_inflight++;
+    msg->ts_send = apibus_now();
+    list_move_tail(&msg->node_sinkfd, &sinkfd->acks_wait);
+    list_add_tail(&msg->node, &bus->acks_wait);
+    apibus_send(bus, sinkfd->fd, msg->pac->raw, msg->pac->len);
+}
+
+static void ack_fill_window(struct apibus *bus, struct sinkfd *sinkfd)
+{
+    while (sinkfd->ack_inflight < API_ACK_WINDOW &&
+           !list_empty(&sinkfd->acks_pending)) {
+        ack_send(bus, list_first_entry(
+                     &sinkfd->acks_pending, struct api_ack_msg, node_sinkfd));
+    }
+}
+
+static void
+ack_publish(struct apibus *bus, struct sinkfd *sinkfd, struct api_topic_msg *tmsg)
+{
+    char header[SRRP_HEADER_LEN];
+    snprintf(header, sizeof(header), "%.*s",
+             (int)tmsg->pac.header_len, tmsg->pac.header);
+
+    // a publish with no room left for the seqno is sent as is, untracked
+    struct srrp_packet *seqpac = srrp_write_publish_seqno(
+        sinkfd->ack_seqno, header, tmsg->pac.data);
+    struct api_ack_msg *msg = seqpac ? mempool_alloc(bus->ack_pool) : NULL;
+    if (msg == NULL) {
+        srrp_free(seqpac);
+        bus->ack_drops++;
+        LOG_DEBUG("[ack] #%d untracked publish %.*s", sinkfd->fd,
+                  (int)tmsg->pac.header_len, tmsg->pac.header);
+        apibus_send_view(bus, sinkfd->fd, &tmsg->pac);
+        return;
+    }
+    sinkfd->ack_seqno++;
+    msg->pac = seqpac;
+    int encoding = sinkfd_encoding(sinkfd);
+    if (encoding != SRRP_FRAMING_TEXT) {
+        // left as is if too large, peers parse both framings
+        struct srrp_packet *pac = srrp_convert(msg->pac, encoding);
+        if (pac) {
+            srrp_free(msg->pac);
+            msg->pac = pac;
+            if (sinkfd_framing(sinkfd) == SRRP_FRAMING_BINARY)
+                bus->translations++;
+        }
+    }
+    msg->sinkfd = sinkfd;
+    msg->ts_send = 0;
+    INIT_LIST_HEAD(&msg->node);
+    list_add_tail(&msg->node_sinkfd, &sinkfd->acks_pending);
+    sinkfd->ack_npending++;
+
+    if (sinkfd->ack_inflight >= API_ACK_WINDOW) {
+        bus->ack_stalls++;
+        if (sinkfd->ack_npending > API_ACK_BACKLOG_MAX) {
+            ack_msg_delete(bus, list_first_entry(
+                               &sinkfd->acks_pending, struct api_ack_msg,
+                               node_sinkfd));
+            bus->ack_drops++;
+        }
+        return;
+    }
+
+    ack_send(bus, msg);
+}
+
+// bus->acks_wait is ordered by ts_send, stop at the first one in time
+static void redeliver_ack(struct apibus *bus)
+{
+    uint64_t now = apibus_now();
+    while (!list_empty(&bus->acks_wait)) {
+        struct api_ack_msg *msg = list_first_entry(
+            &bus->acks_wait, struct api_ack_msg, node);
+        if (now < msg->ts_send + API_ACK_TIMEOUT)
             break;
+        msg->ts_send = now;
+        list_move_tail(&msg->node, &bus->acks_wait);
+        bus->ack_redeliveries++;
+        apibus_send(bus, msg->sinkfd->fd, msg->pac->raw, msg->pac->len);
+    }
+}
+
+// drop what the bus holds for a sinkfd going away
+static void detach_sinkfd(struct apibus *bus, struct sinkfd *sinkfd)
+{
+    // the cache of a topic outlives its subscribers, see topic_retain
+    struct api_subscriber *pos, *n;
+    list_for_each_entry_safe(pos, n, &sinkfd->subscribers, node_sinkfd) {
+        struct api_topic *topic = pos->topic;
+        del_subscriber(bus, pos);
+        prune_topic(bus, topic);
+    }
+
+    struct api_ack_msg *msg, *tmp;
+    list_for_each_entry_safe(msg, tmp, &sinkfd->acks_wait, node_sinkfd)
+        ack_msg_delete(bus, msg);
+    list_for_each_entry_safe(msg, tmp, &sinkfd->acks_pending, node_sinkfd)
+        ack_msg_delete(bus, msg);
+
+    struct api_assembly *asb, *asb_tmp;
+    list_for_each_entry_safe(asb, asb_tmp, &sinkfd->assemblies, node)
+        assembly_delete(bus, asb);
+    sinkfd->nassemblies = 0;
+}
+
+/*
+ * A subscribe with {cache:N} makes the topic retain the last N packets
+ * published to it, within a byte budget of API_TOPIC_CACHE_PACKET_SIZE
+ * per packet. They are kept while no one is subscribed, and replayed to
+ * every new subscriber, so a consumer reconnecting does not lose what
+ * was published meanwhile. An explicit unsubscribe of the last
+ * subscriber drops the cache.
+ */
+
+static void topic_set_cache(struct api_topic *topic, int cache)
+{
+    if (cache > SRRP_SUBSCRIBE_CACHE_MAX)
+        cache = SRRP_SUBSCRIBE_CACHE_MAX;
+    if (cache <= topic->cache_max)
+        return;
+
+    // mirrored where supported, so records are replayed in place
+    size_t size = cache * API_TOPIC_CACHE_PACKET_SIZE +
+        sizeof(uint16_t) + SRRP_LENGTH_MAX + 1;
+    ringbuf_t *ring = ringbuf_new_mirrored(size);
+    if (ring == NULL)
+        ring = ringbuf_new(size);
+    if (topic->cache) {
+        size_t used = ringbuf_used(topic->cache);
+        if (ringbuf_read_contig(topic->cache) == used) {
+            ringbuf_write(ring, ringbuf_read_pos(topic->cache), used);
+        } else {
+            char *tmp = malloc(used);
+            ringbuf_read(topic->cache, tmp, used);
+            ringbuf_write(ring, tmp, used);
+            free(tmp);
         }
+        ringbuf_delete(topic->cache);
+    }
+    topic->cache = ring;
+    topic->cache_max = cache;
+}
+
+static void topic_drop_cache(struct api_topic *topic)
+{
+    ringbuf_delete(topic->cache);
+    topic->cache = NULL;
+    topic->cache_max = 0;
+    topic->ncached = 0;
+}
+
+// packets are kept as a uint16_t length followed by the raw packet
+static void topic_retain(struct api_topic *topic, struct api_topic_msg *tmsg)
+{
+    uint16_t len = tmsg->pac.len;
+
+    if (tmsg->pac.raw == NULL) {
+        LOG_DEBUG("reassembled publish is not retained: %.*s",
+                  (int)tmsg->pac.header_len, tmsg->pac.header);
+        return;
+    }
+
+    // evict the oldest, one byte is left spare as the ring can not be full
+    while (topic->ncached &&
+           (topic->ncached >= topic->cache_max ||
+            ringbuf_spare(topic->cache) <= sizeof(len) + len)) {
+        uint16_t oldlen;
+        ringbuf_peek(topic->cache, &oldlen, sizeof(oldlen));
+        ringbuf_read_advance(topic->cache, sizeof(oldlen) + oldlen);
+        topic->ncached--;
+    }
+
+    ringbuf_write(topic->cache, &len, sizeof(len));
+    ringbuf_write(topic->cache, tmsg->pac.raw, len);
+    topic->ncached++;
+}
+
+static void topic_replay(struct apibus *bus, struct api_topic *topic, int fd)
+{
+    size_t used = ringbuf_used(topic->cache);
+    char *copy = NULL;
+    char *buf = ringbuf_read_pos(topic->cache);
+    if (ringbuf_read_contig(topic->cache) != used) {
+        buf = copy = malloc(used);
+        ringbuf_peek(topic->cache, buf, used);
+    }
+
+    size_t offset = 0;
+    while (offset < used) {
+        uint16_t len;
+        memcpy(&len, buf + offset, sizeof(len));
+        offset += sizeof(len);
+        struct srrp_view pac;
+        size_t consumed;
+        if (srrp_parse_view(&pac, buf + offset, len, &consumed) == 0)
+            apibus_send_view(bus, fd, &pac);
+        offset += len;
+    }
+
+    free(copy);
+}
+
+static void topic_sub_handler(struct apibus *bus, struct api_topic_msg *tmsg)
+{
+    if (!topic_filter_is_valid(tmsg->pac.header, tmsg->pac.header_len)) {
+        apibus_send(bus, tmsg->fd, "Sub ERR", 7);
+        return;
     }
+
+    struct sinkfd *sinkfd = find_sinkfd_in_apibus(bus, tmsg->fd);
+    if (sinkfd == NULL)
+        return;
+
+    struct api_topic *topic = find_topic(
+        bus, tmsg->pac.header, tmsg->pac.header_len, 1);
     if (topic == NULL) {
-        topic = malloc(sizeof(*topic));
-        memset(topic, 0, sizeof(*topic));
-        snprintf(topic->header, sizeof(topic->header), "%s", tmsg->pac->header);
-        INIT_LIST_HEAD(&topic->node);
-        list_add(&topic->node, &bus->topics);
+        bus->pool_drops++;
+        apibus_send(bus, tmsg->fd, "Sub ERR", 7);
+        return;
+    }
+    // a repeat subscribe only updates the ctrl, the cache is not sent again
+    int replay = 0;
+    struct api_subscriber *sub = find_subscriber(bus, topic, tmsg->fd);
+    if (sub == NULL) {
+        sub = add_subscriber(bus, topic, sinkfd);
+        if (sub == NULL) {
+            prune_topic(bus, topic);
+            apibus_send(bus, tmsg->fd, "Sub ERR", 7);
+            return;
+        }
+        replay = 1;
+    }
+
+    int ack = 0, cache = 0;
+    struct json_object *jo = json_object_new(tmsg->pac.data);
+    if (jo) {
+        json_get_int(jo, "/ack", &ack);
+        if (json_get_int(jo, "/cache", &cache) == 0 && cache > 0)
+            topic_set_cache(topic, cache);
+        json_object_delete(jo);
     }
-    assert(topic);
-    topic->fds[topic->nfds] = tmsg->fd;
-    topic->nfds++;
+    sub->ack = ack;
 
     apibus_send(bus, tmsg->fd, "Sub OK", 6);
+
+    if (replay && topic->cache)
+        topic_replay(bus, topic, tmsg->fd);
 }
 
 static void topic_unsub_handler(struct apibus *bus, struct api_topic_msg *tmsg)
 {
-    struct api_topic *topic = NULL;
-    list_for_each_entry(topic, &bus->topics, node) {
-        if (strcmp(topic->header, tmsg->pac->header) == 0) {
+    struct api_topic *topic = find_topic(
+        bus, tmsg->pac.header, tmsg->pac.header_len, 0);
+    if (topic) {
+        struct api_subscriber *sub = find_subscriber(bus, topic, tmsg->fd);
+        if (sub)
+            del_subscriber(bus, sub);
+        if (list_empty(&topic->subscribers) && topic->cache)
+            topic_drop_cache(topic);
+        prune_topic(bus, topic);
+    }
+
+    apibus_send(bus, tmsg->fd, "Unsub OK", 8);
+}
+
+static void topic_ack_handler(struct apibus *bus, struct api_topic_msg *tmsg)
+{
+    struct sinkfd *sinkfd = find_sinkfd_in_apibus(bus, tmsg->fd);
+    if (sinkfd == NULL)
+        return;
+
+    struct api_ack_msg *pos;
+    list_for_each_entry(pos, &sinkfd->acks_wait, node_sinkfd) {
+        if (pos->pac->seqno == tmsg->pac.seqno) {
+            ack_msg_delete(bus, pos);
             break;
         }
     }
-    if (topic) {
-        for (int i = 0; i < topic->nfds; i++) {
-            if (topic->fds[i] == tmsg->fd) {
-                topic->fds[i] = topic->fds[topic->nfds-1];
-                topic->nfds--;
-            }
-        }
+
+    ack_fill_window(bus, sinkfd);
+}
+
+// a fd subscribed by overlapping filters gets each publish once
+static int topic_deliver(struct apibus *bus, struct api_topic *topic,
+                         struct api_topic_msg *tmsg)
+{
+    if (topic->cache)
+        topic_retain(topic, tmsg);
+
+    int cnt = 0;
+    struct api_subscriber *pos;
+    list_for_each_entry(pos, &topic->subscribers, node_topic) {
+        if (pos->sinkfd->topic_seq == bus->topic_seq)
+            continue;
+        pos->sinkfd->topic_seq = bus->topic_seq;
+        // a reassembled publish is larger than any packet ack mode can hold
+        if (pos->ack && tmsg->pac.raw)
+            ack_publish(bus, pos->sinkfd, tmsg);
+        else
+            apibus_send_view(bus, pos->sinkfd->fd, &tmsg->pac);
+        cnt++;
     }
+    return cnt;
+}
 
-    apibus_send(bus, tmsg->fd, "Unsub OK", 8);
+// topic has matched the segments before p, p is NULL once all matched
+static int topic_match(struct apibus *bus, struct api_topic *topic,
+                       const char *p, const char *end,
+                       struct api_topic_msg *tmsg)
+{
+    int cnt = 0;
+
+    struct api_topic *child = find_topic_child(bus, topic, "#", 1);
+    if (child)
+        cnt += topic_deliver(bus, child, tmsg);
+
+    if (p == NULL)
+        return cnt + topic_deliver(bus, topic, tmsg);
+
+    size_t seg_len;
+    const char *seg = p;
+    p = topic_next_seg(p, end, &seg_len);
+
+    child = find_topic_child(bus, topic, seg, seg_len);
+    if (child)
+        cnt += topic_match(bus, child, p, end, tmsg);
+
+    if (!topic_is_wildcard(seg, seg_len, '+')) {
+        child = find_topic_child(bus, topic, "+", 1);
+        if (child)
+            cnt += topic_match(bus, child, p, end, tmsg);
+    }
+
+    return cnt;
+}
+
+static int topic_publish(struct apibus *bus, struct api_topic_msg *tmsg)
+{
+    bus->topic_seq++;
+    return topic_match(bus, bus->topic_root, tmsg->pac.header,
+                       tmsg->pac.header + tmsg->pac.header_len, tmsg);
 }
 
 static void topic_pub_handler(struct apibus *bus, struct api_topic_msg *tmsg)
 {
-    struct api_topic *topic = find_topic(
-        &bus->topics, tmsg->pac->header, tmsg->pac->header_len);
-    if (topic) {
-        for (int i = 0; i < topic->nfds; i++)
-            apibus_send(bus, topic->fds[i], tmsg->pac->raw, tmsg->pac->len);
-    } else {
+    int cnt = topic_publish(bus, tmsg);
+
+    // the other shards deliver to their own subscribers, if they have topics
+    if (bus->group) {
+        for (int i = 0; i < bus->group->nshards; i++) {
+            struct apibus *shard = bus->group->shards[i];
+            if (shard == bus || __atomic_load_n(
+                    &shard->topic_root->nchildren, __ATOMIC_RELAXED) == 0)
+                continue;
+            handoff_post(bus, i, handoff_new_view(
+                             bus, API_HANDOFF_PUBLISH, tmsg->fd, &tmsg->pac));
+            cnt++;
+        }
+    }
+
+    if (cnt == 0) {
         // do nothing, just drop this msg
-        LOG_DEBUG("drop @: %s%s", tmsg->pac->header, tmsg->pac->data);
+        LOG_DEBUG("drop @: %.*s?%s", (int)tmsg->pac.header_len,
+                  tmsg->pac.header, tmsg->pac.data);
     }
 }
 
@@ -178,12 +1107,36 @@ struct apibus *apibus_new()
     struct apibus *bus = malloc(sizeof(*bus));
     bzero(bus, sizeof(*bus));
     INIT_LIST_HEAD(&bus->requests);
+    INIT_LIST_HEAD(&bus->requests_wait);
+    for (int i = 0; i < APIBUS_REQUEST_HASH_SIZE; i++)
+        INIT_HLIST_HEAD(&bus->request_hash[i]);
     INIT_LIST_HEAD(&bus->responses);
     INIT_LIST_HEAD(&bus->stations);
+    for (int i = 0; i < APIBUS_STATION_HASH_SIZE; i++)
+        INIT_HLIST_HEAD(&bus->station_hash[i]);
     INIT_LIST_HEAD(&bus->topic_msgs);
+    INIT_LIST_HEAD(&bus->acks_wait);
+    INIT_LIST_HEAD(&bus->assembled);
     INIT_LIST_HEAD(&bus->topics);
+    for (int i = 0; i < APIBUS_TOPIC_HASH_SIZE; i++)
+        INIT_HLIST_HEAD(&bus->topic_hash[i]);
+    for (int i = 0; i < APIBUS_SUBSCRIBER_HASH_SIZE; i++)
+        INIT_HLIST_HEAD(&bus->subscriber_hash[i]);
     INIT_LIST_HEAD(&bus->sinkfds);
+    for (int i = 0; i < APIBUS_SINKFD_HASH_SIZE; i++)
+        INIT_HLIST_HEAD(&bus->sinkfd_hash[i]);
     INIT_LIST_HEAD(&bus->sinks);
+    bus->request_pool = mempool_new(sizeof(struct api_request), 0);
+    bus->response_pool = mempool_new(sizeof(struct api_response), 0);
+    bus->topic_msg_pool = mempool_new(sizeof(struct api_topic_msg), 0);
+    bus->station_pool = mempool_new(sizeof(struct api_station), 0);
+    bus->topic_pool = mempool_new(sizeof(struct api_topic), 0);
+    bus->subscriber_pool = mempool_new(sizeof(struct api_subscriber), 0);
+    bus->ack_pool = mempool_new(sizeof(struct api_ack_msg), 0);
+    bus->assembly_pool = mempool_new(sizeof(struct api_assembly), 0);
+    bus->topic_root = add_topic(bus, NULL, "", 0);
+    bus->wakefd[0] = -1;
+    bus->wakefd[1] = -1;
     return bus;
 }
 
@@ -192,35 +1145,30 @@ void apibus_destroy(struct apibus *bus)
     {
         struct api_request *pos, *n;
         list_for_each_entry_safe(pos, n, &bus->requests, node)
-            api_request_delete(pos);
+            api_request_delete(bus, pos);
+        list_for_each_entry_safe(pos, n, &bus->requests_wait, node)
+            api_request_delete(bus, pos);
     }
 
     {
         struct api_response *pos, *n;
         list_for_each_entry_safe(pos, n, &bus->responses, node)
-            api_response_delete(pos);
+            api_response_delete(bus, pos);
     }
 
     {
         struct api_station *pos, *n;
         list_for_each_entry_safe(pos, n, &bus->stations, node) {
+            hlist_del_init(&pos->hnode);
             list_del_init(&pos->node);
-            free(pos);
+            mempool_free(bus->station_pool, pos);
         }
     }
 
     {
         struct api_topic_msg *pos, *n;
         list_for_each_entry_safe(pos, n, &bus->topic_msgs, node)
-            api_topic_msg_delete(pos);
-    }
-
-    {
-        struct api_topic *pos, *n;
-        list_for_each_entry_safe(pos, n, &bus->topics, node) {
-            list_del_init(&pos->node);
-            free(pos);
-        }
+            api_topic_msg_delete(bus, pos);
     }
 
     {
@@ -237,47 +1185,116 @@ void apibus_destroy(struct apibus *bus)
         }
     }
 
+    // subscribers went away with their sinkfds
+    {
+        struct api_topic *pos, *n;
+        list_for_each_entry_safe(pos, n, &bus->topics, node) {
+            list_del_init(&pos->node);
+            ringbuf_delete(pos->cache);
+            mempool_free(bus->topic_pool, pos);
+        }
+    }
+
+    if (bus->inbox) {
+        void *data;
+        while (mpsc_ring_pop(bus->inbox, &data) == 0) {
+            struct api_handoff *h = data;
+            if (h->type == API_HANDOFF_ADOPT)
+                close(h->fd);
+            free(h);
+        }
+        mpsc_ring_delete(bus->inbox);
+    }
+    if (bus->wakefd[0] != -1) {
+        close(bus->wakefd[0]);
+        close(bus->wakefd[1]);
+    }
+
+    mempool_delete(bus->request_pool);
+    mempool_delete(bus->response_pool);
+    mempool_delete(bus->topic_msg_pool);
+    mempool_delete(bus->station_pool);
+    mempool_delete(bus->topic_pool);
+    mempool_delete(bus->subscriber_pool);
+    mempool_delete(bus->ack_pool);
+    mempool_delete(bus->assembly_pool);
     free(bus);
 }
 
+static void expire_request(struct apibus *bus)
+{
+    // requests_wait is ordered by ts_send, stop at the first one in time
+    time_t now = time(0);
+    struct api_request *pos, *n;
+    list_for_each_entry_safe(pos, n, &bus->requests_wait, node) {
+        if (now < pos->ts_send + API_REQUEST_TIMEOUT / 1000)
+            break;
+        apibus_reply(bus, pos->shard, pos->fd, "request timeout", 15);
+        LOG_DEBUG("request timeout: %.4x:%s", pos->srcid, pos->header);
+        api_request_delete(bus, pos);
+    }
+}
+
+static void
+route_request(struct apibus *bus, struct api_request *req, struct api_station *dst)
+{
+    apibus_send_view(bus, dst->fd, &req->pac);
+
+    // pac goes away with rxbuf, keep what matching the response needs
+    memcpy(req->header, req->pac.header, req->pac.header_len);
+    req->header[req->pac.header_len] = 0;
+    memset(&req->pac, 0, sizeof(req->pac));
+
+    req->state = API_REQUEST_ST_WAIT_RESPONSE;
+    req->ts_send = time(0);
+    list_move_tail(&req->node, &bus->requests_wait);
+    hlist_add_head(&req->hnode, &bus->request_hash[
+                       request_hash_fn(req->srcid, req->crc16)]);
+}
+
 static void handle_request(struct apibus *bus)
 {
     struct api_request *pos, *n;
     list_for_each_entry_safe(pos, n, &bus->requests, node) {
-        if (pos->state == API_REQUEST_ST_WAIT_RESPONSE) {
-            if (time(0) < pos->ts_send + API_REQUEST_TIMEOUT / 1000)
-                continue;
-            apibus_send(bus, pos->fd, "request timeout", 15);
-            LOG_DEBUG("request timeout: %s", pos->pac->raw);
-            api_request_delete(pos);
-            continue;
-        }
-
-        LOG_INFO("poll >: %.4x:%s?%s", pos->pac->srcid, pos->pac->header, pos->pac->data);
+        LOG_INFO("poll >: %.4x:%.*s?%s", pos->pac.srcid, (int)pos->pac.header_len,
+                 pos->pac.header, pos->pac.data);
 
-        struct api_station *src = find_station(&bus->stations, pos->pac->srcid);
-        if (src == NULL)
+        struct api_station *src = find_station(bus, pos->pac.srcid);
+        if (src == NULL) {
             add_station(bus, pos);
-        else
-            src->ts_alive = time(0);
+        } else {
+            src->fd = pos->fd;
+            touch_station(bus, src);
+        }
 
         int dstid = 0;
-        int nr = sscanf(pos->pac->header, "/%d/", &dstid);
+        int nr = sscanf(pos->pac.header, "/%d/", &dstid);
         if (nr != 1) {
             apibus_send(bus, pos->fd, "STATION NOT FOUND", 17);
-            api_request_delete(pos);
+            api_request_delete(bus, pos);
+            continue;
+        }
+
+        // the shard the station is on routes it and matches the response
+        int shard = station_shard(bus, dstid);
+        if (shard != -1 && shard != bus->shard) {
+            struct api_handoff *h = handoff_new_view(
+                bus, API_HANDOFF_REQUEST, pos->fd, &pos->pac);
+            if (h)
+                h->dstid = dstid;
+            handoff_post(bus, shard, h);
+            api_request_delete(bus, pos);
             continue;
         }
-        struct api_station *dst = find_station(&bus->stations, dstid);
+
+        struct api_station *dst = shard == -1 ? NULL : find_station(bus, dstid);
         if (dst == NULL) {
             apibus_send(bus, pos->fd, "STATION NOT FOUND", 17);
-            api_request_delete(pos);
+            api_request_delete(bus, pos);
             continue;
         }
 
-        apibus_send(bus, dst->fd, pos->pac->raw, pos->pac->len);
-        pos->state = API_REQUEST_ST_WAIT_RESPONSE;
-        pos->ts_send = time(0);
+        route_request(bus, pos, dst);
     }
 }
 
@@ -285,30 +1302,30 @@ static void handle_response(struct apibus *bus)
 {
     struct api_response *pos, *n;
     list_for_each_entry_safe(pos, n, &bus->responses, node) {
-        LOG_INFO("poll <: %.4x:%s?%s", pos->pac->srcid, pos->pac->header, pos->pac->data);
-
-        struct api_request *pos_req, *n_req;
-        list_for_each_entry_safe(pos_req, n_req, &bus->requests, node) {
-            if (pos_req->crc16 == pos->pac->reqcrc16 &&
-                strcmp(pos_req->pac->header, pos->pac->header) == 0 &&
-                pos_req->pac->srcid == pos->pac->srcid) {
-                apibus_send(bus, pos_req->fd, pos->pac->raw, pos->pac->len);
-                api_request_delete(pos_req);
-                break;
-            }
+        LOG_INFO("poll <: %.4x:%.*s?%s", pos->pac.srcid, (int)pos->pac.header_len,
+                 pos->pac.header, pos->pac.data);
+
+        struct api_request *req = find_request(bus, &pos->pac);
+        if (req && req->shard == bus->shard) {
+            apibus_send_view(bus, req->fd, &pos->pac);
+            api_request_delete(bus, req);
+        } else if (req) {
+            handoff_post(bus, req->shard, handoff_new_view(
+                             bus, API_HANDOFF_RESPONSE, req->fd, &pos->pac));
+            api_request_delete(bus, req);
         }
 
         int dstid = 0;
-        int nr = sscanf(pos->pac->header, "/%d/", &dstid);
+        int nr = sscanf(pos->pac.header, "/%d/", &dstid);
         if (nr == 1) {
-            struct api_station *dst = find_station(&bus->stations, dstid);
+            struct api_station *dst = find_station(bus, dstid);
             if (!dst)
                 LOG_WARN("fake station: %d", dstid);
             else
-                dst->ts_alive = time(0);
+                touch_station(bus, dst);
         }
 
-        api_response_delete(pos);
+        api_response_delete(bus, pos);
     }
 }
 
@@ -316,23 +1333,205 @@ static void handle_topic_msg(struct apibus *bus)
 {
     struct api_topic_msg *pos, *n;
     list_for_each_entry_safe(pos, n, &bus->topic_msgs, node) {
-        if (pos->pac->leader == SRRP_SUBSCRIBE_LEADER) {
+        if (pos->pac.leader == SRRP_SUBSCRIBE_LEADER) {
             topic_sub_handler(bus, pos);
-            LOG_INFO("poll #: %s?%s", pos->pac->header, pos->pac->data);
-        } else if (pos->pac->leader == SRRP_UNSUBSCRIBE_LEADER) {
+            LOG_INFO("poll #: %.*s?%s", (int)pos->pac.header_len,
+                     pos->pac.header, pos->pac.data);
+        } else if (pos->pac.leader == SRRP_UNSUBSCRIBE_LEADER) {
             topic_unsub_handler(bus, pos);
-            LOG_INFO("poll %: %s?%s", pos->pac->header, pos->pac->data);
+            LOG_INFO("poll %: %.*s?%s", (int)pos->pac.header_len,
+                     pos->pac.header, pos->pac.data);
+        } else if (pos->pac.leader == SRRP_ACK_LEADER) {
+            topic_ack_handler(bus, pos);
+            LOG_DEBUG("poll !: %x:%.*s", pos->pac.seqno,
+                      (int)pos->pac.header_len, pos->pac.header);
         } else {
             topic_pub_handler(bus, pos);
-            LOG_INFO("poll @: %s?%s", pos->pac->header, pos->pac->data);
+            LOG_INFO("poll @: %.*s?%s", (int)pos->pac.header_len,
+                     pos->pac.header, pos->pac.data);
         }
-        api_topic_msg_delete(pos);
+        api_topic_msg_delete(bus, pos);
     }
 }
 
-int apibus_poll(struct apibus *bus)
+static void handle_handoff(struct apibus *bus, struct api_handoff *h)
+{
+    if (h->type == API_HANDOFF_REQUEST) {
+        struct api_station *dst = find_station(bus, h->dstid);
+        if (dst == NULL) {
+            apibus_reply(bus, h->shard, h->fd, "STATION NOT FOUND", 17);
+            return;
+        }
+        struct api_request *req = request_new(bus, &h->pac, h->shard, h->fd);
+        if (req)
+            route_request(bus, req, dst);
+    } else if (h->type == API_HANDOFF_RESPONSE) {
+        apibus_send_view(bus, h->fd, &h->pac);
+    } else if (h->type == API_HANDOFF_PUBLISH) {
+        struct api_topic_msg tmsg = {0};
+        tmsg.pac = h->pac;
+        tmsg.fd = h->fd;
+        topic_publish(bus, &tmsg);
+    } else if (h->type == API_HANDOFF_SEND) {
+        apibus_send(bus, h->fd, h->buf, h->len);
+    } else if (h->type == API_HANDOFF_ADOPT) {
+        struct apisink *sink = find_apisink_in_apibus(bus, h->buf);
+        if (sink == NULL || sink->ops.adopt == NULL ||
+            sink->ops.adopt(sink, h->fd) != 0) {
+            LOG_ERROR("[adopt] #%d by %s failed", h->fd, h->buf);
+            close(h->fd);
+        }
+    }
+}
+
+/*
+ * The wake flag is cleared before the pipe is drained, and the pipe
+ * before the inbox, so a handoff pushed meanwhile wakes the next wait.
+ */
+static void handle_inbox(struct apibus *bus)
+{
+#if defined __unix__ || defined __linux__ || defined __APPLE__
+    __atomic_store_n(&bus->wake_pending, 0, __ATOMIC_SEQ_CST);
+    char tmp[64];
+    while (read(bus->wakefd[0], tmp, sizeof(tmp)) > 0);
+#endif
+
+    void *data;
+    while (mpsc_ring_pop(bus->inbox, &data) == 0) {
+        handle_handoff(bus, data);
+        free(data);
+    }
+}
+
+/*
+ * Shorten timeout to the nearest deadline the bus has to act on: a
+ * request waiting for its response, a publish waiting for its ack, or
+ * unparsed bytes in a rxbuf.
+ */
+static int apibus_next_timeout(struct apibus *bus, int timeout)
+{
+    uint64_t deadline = bus->parse_deadline;
+
+    // a handoff may be pushed but not published yet, see handle_inbox
+    if (!list_empty(&bus->requests) ||
+        (bus->inbox && mpsc_ring_used(bus->inbox)))
+        return 0;
+
+    if (!list_empty(&bus->requests_wait)) {
+        struct api_request *req = list_first_entry(
+            &bus->requests_wait, struct api_request, node);
+        uint64_t ts = (req->ts_send + API_REQUEST_TIMEOUT / 1000) * 1000;
+        if (deadline == 0 || ts < deadline)
+            deadline = ts;
+    }
+
+    if (!list_empty(&bus->acks_wait)) {
+        struct api_ack_msg *msg = list_first_entry(
+            &bus->acks_wait, struct api_ack_msg, node);
+        uint64_t ts = msg->ts_send + API_ACK_TIMEOUT;
+        if (deadline == 0 || ts < deadline)
+            deadline = ts;
+    }
+
+    if (deadline == 0)
+        return timeout;
+
+    uint64_t now = apibus_now();
+    if (deadline <= now)
+        return 0;
+    if (timeout < 0 || deadline - now < (uint64_t)timeout)
+        return deadline - now;
+    return timeout;
+}
+
+static void apibus_idle(struct apibus *bus, int timeout)
+{
+    if (bus->poll_cnt == 0) {
+        if (bus->idle_usec != APIBUS_IDLE_MAX) {
+            bus->idle_usec += APIBUS_IDLE_MAX / 10;
+            if (bus->idle_usec > APIBUS_IDLE_MAX)
+                bus->idle_usec = APIBUS_IDLE_MAX;
+        }
+        if (timeout < 0 || bus->idle_usec < (uint64_t)timeout * 1000)
+            usleep(bus->idle_usec);
+        else
+            usleep(timeout * 1000);
+    } else {
+        bus->idle_usec = APIBUS_IDLE_MAX / 10;
+    }
+}
+
+/*
+ * Block in the kernel on the waitfds of all sinks. Sinks sharing one
+ * event backend share the waitfd, so it is polled once. If any sink can
+ * not be waited on, fall back to the idle backoff.
+ */
+static void apibus_wait(struct apibus *bus, int timeout)
+{
+    if (timeout == 0)
+        return;
+
+#if defined __unix__ || defined __linux__ || defined __APPLE__
+    int nr_sinks = 0;
+    struct apisink *pos;
+    list_for_each_entry(pos, &bus->sinks, node)
+        nr_sinks++;
+
+    struct pollfd pfds[nr_sinks + 1];
+    int nfds = 0;
+
+    if (bus->wakefd[0] != -1) {
+        pfds[nfds].fd = bus->wakefd[0];
+        pfds[nfds].events = POLLIN;
+        pfds[nfds].revents = 0;
+        nfds++;
+    }
+
+    list_for_each_entry(pos, &bus->sinks, node) {
+        int fd = pos->ops.waitfd ? pos->ops.waitfd(pos) : -1;
+        if (fd == -1) {
+            apibus_idle(bus, timeout);
+            return;
+        }
+
+        int i;
+        for (i = 0; i < nfds; i++) {
+            if (pfds[i].fd == fd)
+                break;
+        }
+        if (i == nfds) {
+            pfds[nfds].fd = fd;
+            pfds[nfds].events = POLLIN;
+            pfds[nfds].revents = 0;
+            nfds++;
+        }
+    }
+
+    if (poll(pfds, nfds, timeout) == -1 && errno != EINTR)
+        LOG_ERROR("[poll] (%d) %s", errno, strerror(errno));
+#else
+    apibus_idle(bus, timeout);
+#endif
+}
+
+static void apibus_flush(struct apibus *bus)
+{
+    struct apisink *pos;
+    list_for_each_entry(pos, &bus->sinks, node) {
+        if (pos->ops.flush && pos->ops.flush(pos) != 0)
+            LOG_ERROR("%s", strerror(errno));
+    }
+}
+
+int apibus_poll_timeout(struct apibus *bus, int timeout)
 {
+    // packets sent by the user since the last poll
+    apibus_flush(bus);
+
+    apibus_wait(bus, apibus_next_timeout(bus, timeout));
+
     bus->poll_cnt = 0;
+    bus->parse_deadline = 0;
     gettimeofday(&bus->poll_ts, NULL);
 
     // poll each sink
@@ -343,49 +1542,219 @@ int apibus_poll(struct apibus *bus)
         }
     }
 
-    // parse each sinkfds
-    struct sinkfd *pos_fd;
-    list_for_each_entry(pos_fd, &bus->sinkfds, node_bus) {
+    // parse each sinkfds and handle its msgs while rxbuf holds the views
+    struct sinkfd *pos_fd, *n_fd;
+    list_for_each_entry_safe(pos_fd, n_fd, &bus->sinkfds, node_bus) {
         if (timercmp(&bus->poll_ts, &pos_fd->ts_poll_recv, <))
             bus->poll_cnt++;
         if (atbuf_used(pos_fd->rxbuf)) {
-            parse_packet(bus, pos_fd);
+            size_t consumed = parse_packet(bus, pos_fd);
+            handle_request(bus);
+            handle_response(bus);
+            handle_topic_msg(bus);
+            atbuf_read_advance(pos_fd->rxbuf, consumed);
+
+            struct api_assembly *asb, *asb_tmp;
+            list_for_each_entry_safe(asb, asb_tmp, &bus->assembled, node)
+                assembly_delete(bus, asb);
+        }
+        if (pos_fd->eof) {
+            LOG_DEBUG("[read] #%d finished", pos_fd->fd);
+            apibus_close(bus, pos_fd->fd);
+            continue;
+        }
+        if (!list_empty(&pos_fd->assemblies))
+            expire_assembly(bus, pos_fd);
+        // a grown rxbuf is given back once drained and idle
+        if (atbuf_used(pos_fd->rxbuf) == 0 &&
+            atbuf_size(pos_fd->rxbuf) > SINKFD_RX_SIZE &&
+            timeval_ms(&bus->poll_ts) >=
+            timeval_ms(&pos_fd->ts_poll_recv) + SINKFD_RX_IDLE &&
+            atbuf_realloc(pos_fd->rxbuf, SINKFD_RX_SIZE) == 0)
+            bus->rx_shrinks++;
+        // a partial packet is dropped once PARSE_PACKET_TIMEOUT expires
+        if (atbuf_used(pos_fd->rxbuf)) {
+            uint64_t ts = (pos_fd->ts_poll_recv.tv_sec +
+                           PARSE_PACKET_TIMEOUT / 1000) * 1000;
+            if (bus->parse_deadline == 0 || ts < bus->parse_deadline)
+                bus->parse_deadline = ts;
         }
     }
 
     LOG_DEBUG("poll_cnt: %d", bus->poll_cnt);
-    if (bus->poll_cnt == 0) {
-        if (bus->idle_usec != APIBUS_IDLE_MAX) {
-            bus->idle_usec += APIBUS_IDLE_MAX / 10;
-            if (bus->idle_usec > APIBUS_IDLE_MAX)
-                bus->idle_usec = APIBUS_IDLE_MAX;
-        }
-        usleep(bus->idle_usec);
-    } else {
-        bus->idle_usec = APIBUS_IDLE_MAX / 10;
-    }
 
-    // hander each msg
-    handle_request(bus);
-    handle_response(bus);
-    handle_topic_msg(bus);
+    if (bus->inbox)
+        handle_inbox(bus);
+
+    expire_request(bus);
+    redeliver_ack(bus);
 
     // clear station which is not alive
     clear_unalive_station(bus);
 
+    // one write per fd for all packets routed in this poll
+    apibus_flush(bus);
+
     return 0;
 }
 
-int apibus_open(struct apibus *bus, const char *name, const char *addr)
+int apibus_poll(struct apibus *bus)
 {
-    struct apisink *pos;
-    list_for_each_entry(pos, &bus->sinks, node) {
-        if (strcmp(pos->name, name) == 0) {
-            assert(pos->ops.open);
-            return pos->ops.open(pos, addr);
+    return apibus_poll_timeout(bus, APIBUS_IDLE_MAX / 1000);
+}
+
+int apibus_run(struct apibus *bus)
+{
+    bus->stop = 0;
+    while (bus->stop == 0)
+        apibus_poll_timeout(bus, APIBUS_IDLE_MAX / 1000);
+    return 0;
+}
+
+void apibus_stop(struct apibus *bus)
+{
+    bus->stop = 1;
+}
+
+// the inbox and the wake pipe a shard takes handoffs with
+static int apibus_shard_init(struct apibus *bus)
+{
+    bus->inbox = mpsc_ring_new(APIBUS_GROUP_INBOX_SIZE);
+    if (bus->inbox == NULL)
+        return -1;
+#if defined __unix__ || defined __linux__ || defined __APPLE__
+    if (pipe(bus->wakefd) != 0) {
+        LOG_ERROR("[pipe] (%d) %s", errno, strerror(errno));
+        bus->wakefd[0] = bus->wakefd[1] = -1;
+        return -1;
+    }
+    for (int j = 0; j < 2; j++) {
+        fcntl(bus->wakefd[j], F_SETFL,
+              fcntl(bus->wakefd[j], F_GETFL) | O_NONBLOCK);
+        fcntl(bus->wakefd[j], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    return 0;
+}
+
+struct apibus_group *apibus_group_new(int nshards)
+{
+    if (nshards < 1 || nshards > APIBUS_GROUP_SHARDS_MAX)
+        return NULL;
+
+    struct apibus_group *group = calloc(1, sizeof(*group));
+    if (group == NULL)
+        return NULL;
+    group->nshards = nshards;
+    group->shards = calloc(nshards, sizeof(*group->shards));
+    if (group->shards == NULL) {
+        free(group);
+        return NULL;
+    }
+
+    for (int i = 0; i < nshards; i++) {
+        struct apibus *bus = apibus_new();
+        bus->group = group;
+        bus->shard = i;
+        group->shards[i] = bus;
+        // handoff_post relies on every shard taking handoffs
+        if (apibus_shard_init(bus) != 0) {
+            while (i >= 0)
+                apibus_destroy(group->shards[i--]);
+            free(group->shards);
+            free(group);
+            return NULL;
         }
     }
-    return -1;
+
+    return group;
+}
+
+// the shards are stopped and their sinks disabled by the caller
+void apibus_group_destroy(struct apibus_group *group)
+{
+    assert(group->tasks == NULL);
+    for (int i = 0; i < group->nshards; i++)
+        apibus_destroy(group->shards[i]);
+    free(group->shards);
+    free(group);
+}
+
+int apibus_group_size(struct apibus_group *group)
+{
+    return group->nshards;
+}
+
+struct apibus *apibus_group_shard(struct apibus_group *group, int index)
+{
+    if (index < 0 || index >= group->nshards)
+        return NULL;
+    return group->shards[index];
+}
+
+static void get_pool_stat(mempool_t *pool, struct apibus_pool_stat *stat)
+{
+    stat->used = mempool_used(pool);
+    stat->peak = mempool_peak(pool);
+    stat->capacity = mempool_capacity(pool);
+}
+
+void apibus_get_stats(struct apibus *bus, struct apibus_stats *stats)
+{
+    get_pool_stat(bus->request_pool, &stats->requests);
+    get_pool_stat(bus->response_pool, &stats->responses);
+    get_pool_stat(bus->topic_msg_pool, &stats->topic_msgs);
+    get_pool_stat(bus->station_pool, &stats->stations);
+    get_pool_stat(bus->topic_pool, &stats->topics);
+    get_pool_stat(bus->subscriber_pool, &stats->subscribers);
+    stats->ack_redeliveries = bus->ack_redeliveries;
+    stats->ack_stalls = bus->ack_stalls;
+    stats->ack_drops = bus->ack_drops;
+    stats->translations = bus->translations;
+    stats->tx_drops = bus->tx_drops;
+    stats->tx_packets = bus->tx_packets;
+    stats->tx_syscalls = bus->tx_syscalls;
+    stats->rx_grows = bus->rx_grows;
+    stats->rx_shrinks = bus->rx_shrinks;
+    stats->handoffs = bus->handoffs;
+    stats->handoff_drops = bus->handoff_drops;
+    stats->pool_drops = bus->pool_drops;
+}
+
+int apibus_get_fd_stats(struct apibus *bus, int fd, struct apibus_fd_stats *stats)
+{
+    struct sinkfd *sinkfd = find_sinkfd_in_apibus(bus, fd);
+    if (sinkfd == NULL)
+        return -1;
+
+    stats->rx_size = atbuf_size(sinkfd->rxbuf);
+    stats->rx_cap = sinkfd->rx_cap;
+    stats->rx_used = atbuf_used(sinkfd->rxbuf);
+    stats->rx_peak = sinkfd->rx_peak;
+    stats->tx_used = chainbuf_used(sinkfd->txbuf);
+    return 0;
+}
+
+int apibus_get_fds(struct apibus *bus, int *fds, int size)
+{
+    int n = 0;
+    struct sinkfd *pos;
+    // sinkfds are added at the head, walk back for the oldest first
+    list_for_each_entry_reverse(pos, &bus->sinkfds, node_bus) {
+        if (n == size)
+            break;
+        fds[n++] = pos->fd;
+    }
+    return n;
+}
+
+int apibus_open(struct apibus *bus, const char *name, const char *addr)
+{
+    struct apisink *sink = find_apisink_in_apibus(bus, name);
+    if (sink == NULL)
+        return -1;
+    assert(sink->ops.open);
+    return sink->ops.open(sink, addr);
 }
 
 int apibus_close(struct apibus *bus, int fd)
@@ -403,6 +1772,31 @@ int apibus_ioctl(struct apibus *bus, int fd, unsigned int cmd, unsigned long arg
     struct sinkfd *sinkfd = find_sinkfd_in_apibus(bus, fd);
     if (sinkfd == NULL)
         return -1;
+
+    if (cmd == APIBUS_IOCTL_TX_HWM) {
+        sinkfd->tx_hwm = arg;
+        return 0;
+    } else if (cmd == APIBUS_IOCTL_TX_POLICY) {
+        if (arg != APIBUS_TX_POLICY_DROP && arg != APIBUS_TX_POLICY_CLOSE)
+            return -1;
+        sinkfd->tx_policy = arg;
+        return 0;
+    } else if (cmd == APIBUS_IOCTL_FRAMING) {
+        if (arg != APIBUS_FRAMING_AUTO && arg != APIBUS_FRAMING_TEXT &&
+            arg != APIBUS_FRAMING_BINARY)
+            return -1;
+        sinkfd->framing = arg;
+        return 0;
+    } else if (cmd == APIBUS_IOCTL_CRC16) {
+        sinkfd->crc16 = arg != 0;
+        return 0;
+    } else if (cmd == APIBUS_IOCTL_RX_CAP) {
+        if (arg < SINKFD_RX_SIZE)
+            return -1;
+        sinkfd->rx_cap = arg;
+        return 0;
+    }
+
     if (sinkfd->sink == NULL || sinkfd->sink->ops.ioctl == NULL)
         return -1;
     return sinkfd->sink->ops.ioctl(sinkfd->sink, fd, cmd, arg);
@@ -463,40 +1857,137 @@ int apibus_add_sink(struct apibus *bus, struct apisink *sink)
 
 void apibus_del_sink(struct apibus *bus, struct apisink *sink)
 {
-    UNUSED(bus);
+    // sinkfds may outlive the link to the bus, drop what refers to them
+    struct sinkfd *pos;
+    list_for_each_entry(pos, &sink->sinkfds, node_sink)
+        detach_sinkfd(bus, pos);
+
     list_del_init(&sink->node);
     sink->bus = NULL;
 }
 
-struct sinkfd *sinkfd_new()
+struct apisink *find_apisink_in_apibus(struct apibus *bus, const char *name)
+{
+    struct apisink *pos;
+    list_for_each_entry(pos, &bus->sinks, node) {
+        if (strcmp(pos->name, name) == 0)
+            return pos;
+    }
+    return NULL;
+}
+
+#define sinkfd_hash_fn(fd) ((unsigned int)(fd) % APIBUS_SINKFD_HASH_SIZE)
+
+struct sinkfd *sinkfd_new(struct apisink *sink, int fd)
 {
+    assert(sink->bus);
+
     struct sinkfd *sinkfd = malloc(sizeof(struct sinkfd));
+    if (sinkfd == NULL)
+        return NULL;
     memset(sinkfd, 0, sizeof(*sinkfd));
-    sinkfd->fd = 0;
+    sinkfd->fd = fd;
     sinkfd->listen = 0;
-    sinkfd->txbuf = atbuf_new(0);
-    sinkfd->rxbuf = atbuf_new(0);
-    sinkfd->sink = NULL;
+    sinkfd->txbuf = chainbuf_new(0);
+    sinkfd->rxbuf = atbuf_new(SINKFD_RX_SIZE);
+    if (sinkfd->txbuf == NULL || sinkfd->rxbuf == NULL) {
+        if (sinkfd->txbuf)
+            chainbuf_delete(sinkfd->txbuf);
+        if (sinkfd->rxbuf)
+            atbuf_delete(sinkfd->rxbuf);
+        free(sinkfd);
+        return NULL;
+    }
+    sinkfd->rx_cap = SINKFD_RX_CAP;
+    sinkfd->tx_hwm = SINKFD_TX_HWM;
+    sinkfd->tx_policy = APIBUS_TX_POLICY_DROP;
+    sinkfd->framing = APIBUS_FRAMING_AUTO;
+    sinkfd->rx_framing = SRRP_FRAMING_TEXT;
+    sinkfd->sink = sink;
     INIT_LIST_HEAD(&sinkfd->node_sink);
     INIT_LIST_HEAD(&sinkfd->node_bus);
+    INIT_HLIST_NODE(&sinkfd->node_hash);
+    INIT_LIST_HEAD(&sinkfd->node_flush);
+    INIT_LIST_HEAD(&sinkfd->subscribers);
+    INIT_LIST_HEAD(&sinkfd->acks_wait);
+    INIT_LIST_HEAD(&sinkfd->acks_pending);
+    INIT_LIST_HEAD(&sinkfd->assemblies);
+
+    list_add(&sinkfd->node_sink, &sink->sinkfds);
+    list_add(&sinkfd->node_bus, &sink->bus->sinkfds);
+    hlist_add_head(&sinkfd->node_hash,
+                   &sink->bus->sinkfd_hash[sinkfd_hash_fn(fd)]);
     return sinkfd;
 }
 
 void sinkfd_destroy(struct sinkfd *sinkfd)
 {
+    if (sinkfd->sink && sinkfd->sink->bus)
+        detach_sinkfd(sinkfd->sink->bus, sinkfd);
+
     sinkfd->fd = 0;
-    atbuf_delete(sinkfd->txbuf);
+    chainbuf_delete(sinkfd->txbuf);
     atbuf_delete(sinkfd->rxbuf);
     sinkfd->sink = NULL;
     list_del_init(&sinkfd->node_sink);
     list_del_init(&sinkfd->node_bus);
+    hlist_del_init(&sinkfd->node_hash);
+    list_del_init(&sinkfd->node_flush);
     free(sinkfd);
 }
 
+static int sinkfd_rx_grow(struct sinkfd *sinkfd)
+{
+    size_t size = atbuf_size(sinkfd->rxbuf);
+    size_t cap = sinkfd->rx_cap;
+    if (size >= cap)
+        return -1;
+    if (atbuf_realloc(sinkfd->rxbuf, size << 1 < cap ? size << 1 : cap) != 0)
+        return -1;
+    if (sinkfd->sink && sinkfd->sink->bus)
+        sinkfd->sink->bus->rx_grows++;
+    return 0;
+}
+
+size_t sinkfd_rx_spare(struct sinkfd *sinkfd)
+{
+    // one byte is kept for the null atbuf terminates the data with
+    if (atbuf_spare(sinkfd->rxbuf) > 1)
+        return atbuf_spare(sinkfd->rxbuf) - 1;
+
+    atbuf_tidy(sinkfd->rxbuf);
+    if (atbuf_spare(sinkfd->rxbuf) > 1)
+        return atbuf_spare(sinkfd->rxbuf) - 1;
+
+    if (sinkfd_rx_grow(sinkfd) != 0)
+        return 0;
+    return atbuf_spare(sinkfd->rxbuf) - 1;
+}
+
+size_t sinkfd_rx_reserve(struct sinkfd *sinkfd, size_t len)
+{
+    if (atbuf_spare(sinkfd->rxbuf) > len)
+        return atbuf_spare(sinkfd->rxbuf) - 1;
+
+    atbuf_tidy(sinkfd->rxbuf);
+    while (atbuf_spare(sinkfd->rxbuf) <= len) {
+        if (sinkfd_rx_grow(sinkfd) != 0)
+            break;
+    }
+    return atbuf_spare(sinkfd->rxbuf) ? atbuf_spare(sinkfd->rxbuf) - 1 : 0;
+}
+
+void sinkfd_rx_advance(struct sinkfd *sinkfd, size_t len)
+{
+    atbuf_write_advance(sinkfd->rxbuf, len);
+    if (atbuf_used(sinkfd->rxbuf) > sinkfd->rx_peak)
+        sinkfd->rx_peak = atbuf_used(sinkfd->rxbuf);
+}
+
 struct sinkfd *find_sinkfd_in_apibus(struct apibus *bus, int fd)
 {
-    struct sinkfd *pos, *n;
-    list_for_each_entry_safe(pos, n, &bus->sinkfds, node_bus) {
+    struct sinkfd *pos;
+    hlist_for_each_entry(pos, &bus->sinkfd_hash[sinkfd_hash_fn(fd)], node_hash) {
         if (pos->fd == fd)
             return pos;
     }
@@ -505,6 +1996,11 @@ struct sinkfd *find_sinkfd_in_apibus(struct apibus *bus, int fd)
 
 struct sinkfd *find_sinkfd_in_apisink(struct apisink *sink, int fd)
 {
+    if (sink->bus) {
+        struct sinkfd *sinkfd = find_sinkfd_in_apibus(sink->bus, fd);
+        return sinkfd && sinkfd->sink == sink ? sinkfd : NULL;
+    }
+
     struct sinkfd *pos, *n;
     list_for_each_entry_safe(pos, n, &sink->sinkfds, node_sink) {
         if (pos->fd == fd)
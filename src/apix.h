@@ -2,6 +2,7 @@
 #define __APIX_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -9,9 +10,81 @@ extern "C" {
 
 struct apibus;
 
+/*
+ * apibus_ioctl cmds handled by the bus for any fd, others go to its sink
+ */
+#define APIBUS_IOCTL_TX_HWM 0x4101 // arg: max bytes queued for the fd
+#define APIBUS_IOCTL_TX_POLICY 0x4102 // arg: APIBUS_TX_POLICY_*
+#define APIBUS_IOCTL_FRAMING 0x4103 // arg: APIBUS_FRAMING_*
+#define APIBUS_IOCTL_RX_CAP 0x4104 // arg: max rxbuf bytes of the fd, or of the fds a listener accepts
+#define APIBUS_IOCTL_CRC16 0x4105 // arg: 1 to add the crc16 trailer to packets the bus encodes for the fd
+
+#define APIBUS_TX_POLICY_DROP 0 // drop the packet, apibus_send fails with EAGAIN
+#define APIBUS_TX_POLICY_CLOSE 1 // disconnect the peer that does not keep up
+
+#define APIBUS_FRAMING_AUTO 0 // srrp framing the peer last sent, text at first
+#define APIBUS_FRAMING_TEXT 1
+#define APIBUS_FRAMING_BINARY 2
+
+struct apibus_pool_stat {
+    size_t used;
+    size_t peak; // high-water mark of used
+    size_t capacity;
+};
+
+struct apibus_stats {
+    struct apibus_pool_stat requests;
+    struct apibus_pool_stat responses;
+    struct apibus_pool_stat topic_msgs;
+    struct apibus_pool_stat stations;
+    struct apibus_pool_stat topics;
+    struct apibus_pool_stat subscribers;
+    uint64_t tx_drops; // packets refused by a full output queue
+    uint64_t tx_packets; // packets queued for output
+    uint64_t tx_syscalls; // writes issued, tx_syscalls / tx_packets per packet
+    uint64_t ack_redeliveries; // publishes sent again for a missing ack
+    uint64_t ack_stalls; // publishes held back by a full ack window
+    uint64_t ack_drops; // held back publishes dropped by a full backlog, or sent untracked
+    uint64_t translations; // packets re-encoded for a peer of the other framing
+    uint64_t rx_grows; // rxbufs grown to take a larger burst or packet
+    uint64_t rx_shrinks; // grown rxbufs given back once idle
+    uint64_t handoffs; // packets and fds handed to another shard of the group
+    uint64_t handoff_drops; // handoffs refused by a full inbox
+    uint64_t pool_drops; // packets, subscriptions or stations dropped for an exhausted pool
+};
+
+struct apibus_fd_stats {
+    size_t rx_size; // bytes allocated for the rxbuf
+    size_t rx_cap; // max rx_size, see APIBUS_IOCTL_RX_CAP
+    size_t rx_used;
+    size_t rx_peak; // high-water mark of rx_used
+    size_t tx_used; // bytes queued for output
+};
+
 struct apibus *apibus_new();
 void apibus_destroy(struct apibus *bus);
 int apibus_poll(struct apibus *bus);
+int apibus_poll_timeout(struct apibus *bus, int timeout /*ms, -1 forever*/);
+int apibus_run(struct apibus *bus);
+void apibus_stop(struct apibus *bus);
+void apibus_get_stats(struct apibus *bus, struct apibus_stats *stats);
+int apibus_get_fd_stats(struct apibus *bus, int fd, struct apibus_fd_stats *stats);
+// fill fds with up to size fds of the bus, listeners too, in the order they were opened or accepted
+int apibus_get_fds(struct apibus *bus, int *fds, int size);
+
+/*
+ * A group of nshards buses, each owning the fds it polls, that route
+ * requests, responses and publishes between them as a single bus does.
+ * Sinks are enabled and opened on each shard, fds accepted by a shard
+ * are spread over all of them. The shards are polled by one thread each,
+ * see apibus_group_start, or by the caller.
+ */
+struct apibus_group;
+
+struct apibus_group *apibus_group_new(int nshards);
+void apibus_group_destroy(struct apibus_group *group);
+int apibus_group_size(struct apibus_group *group);
+struct apibus *apibus_group_shard(struct apibus_group *group, int index);
 
 int /*fd*/ apibus_open(struct apibus *bus, const char *name, const char *addr);
 int apibus_close(struct apibus *bus, int fd);
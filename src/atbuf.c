@@ -136,7 +136,8 @@ size_t atbuf_read(atbuf_t *self, void *ptr, size_t len)
 
 size_t atbuf_write(atbuf_t *self, const void *ptr, size_t len)
 {
-    if (len > atbuf_spare(self)) {
+    // keep one byte spare for the terminating null
+    if (len >= atbuf_spare(self)) {
         atbuf_tidy(self);
         atbuf_realloc(self, self->size > len ? self->size<<1 : len<<1);
     }
@@ -0,0 +1,219 @@
+#include "chainbuf.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "list.h"
+
+struct chainbuf_block {
+    size_t head; // offset of the first used byte
+    size_t tail; // offset after the last used byte
+    struct list_head node;
+    char data[0];
+};
+
+struct chainbuf {
+    size_t block_size;
+    size_t used;
+    int nblocks;
+    struct list_head blocks;
+    struct chainbuf_block *wblock; // the block written to, blocks after it are empty
+    struct chainbuf_block *spare; // the last released block, kept to be reused
+};
+
+static struct chainbuf_block *block_new(chainbuf_t *self)
+{
+    struct chainbuf_block *block = self->spare;
+    if (block) {
+        self->spare = NULL;
+    } else {
+        block = malloc(sizeof(*block) + self->block_size);
+        if (!block) return NULL;
+    }
+    block->head = 0;
+    block->tail = 0;
+    list_add_tail(&block->node, &self->blocks);
+    self->nblocks++;
+    return block;
+}
+
+static void block_release(chainbuf_t *self, struct chainbuf_block *block)
+{
+    list_del(&block->node);
+    self->nblocks--;
+    if (self->spare)
+        free(block);
+    else
+        self->spare = block;
+}
+
+chainbuf_t *chainbuf_new(size_t block_size)
+{
+    if (block_size == 0)
+        block_size = CHAINBUF_DEFAULT_BLOCK_SIZE;
+
+    chainbuf_t *self = (chainbuf_t *)calloc(sizeof(chainbuf_t), 1);
+    if (!self) return NULL;
+
+    self->block_size = block_size;
+    INIT_LIST_HEAD(&self->blocks);
+    return self;
+}
+
+void chainbuf_delete(chainbuf_t *self)
+{
+    if (self) {
+        struct chainbuf_block *pos, *n;
+        list_for_each_entry_safe(pos, n, &self->blocks, node)
+            free(pos);
+        free(self->spare);
+        free(self);
+    }
+}
+
+size_t chainbuf_used(chainbuf_t *self)
+{
+    return self->used;
+}
+
+size_t chainbuf_nblocks(chainbuf_t *self)
+{
+    return self->nblocks;
+}
+
+int chainbuf_read_vec(chainbuf_t *self, struct chainbuf_vec *vec, int nvec)
+{
+    int cnt = 0;
+    struct chainbuf_block *pos;
+    list_for_each_entry(pos, &self->blocks, node) {
+        if (cnt == nvec || pos->tail == pos->head)
+            break;
+        vec[cnt].base = pos->data + pos->head;
+        vec[cnt].len = pos->tail - pos->head;
+        cnt++;
+    }
+    return cnt;
+}
+
+size_t chainbuf_read_advance(chainbuf_t *self, size_t len)
+{
+    size_t left = len < self->used ? len : self->used;
+    size_t retval = left;
+
+    while (left) {
+        struct chainbuf_block *first = list_first_entry(
+            &self->blocks, struct chainbuf_block, node);
+        size_t n = first->tail - first->head;
+        if (n > left)
+            n = left;
+        first->head += n;
+        left -= n;
+
+        // an emptied block goes away, the write block is just rewound
+        if (first->head == first->tail) {
+            if (first == self->wblock) {
+                first->head = first->tail = 0;
+            } else {
+                block_release(self, first);
+            }
+        }
+    }
+
+    self->used -= retval;
+    return retval;
+}
+
+int chainbuf_write_vec(chainbuf_t *self, size_t len,
+                       struct chainbuf_vec *vec, int nvec)
+{
+    if (self->wblock == NULL) {
+        self->wblock = block_new(self);
+        if (!self->wblock) return 0;
+    }
+
+    int cnt = 0;
+    struct chainbuf_block *pos = self->wblock;
+    while (len && cnt < nvec) {
+        size_t n = self->block_size - pos->tail;
+        if (n) {
+            if (n > len)
+                n = len;
+            vec[cnt].base = pos->data + pos->tail;
+            vec[cnt].len = n;
+            cnt++;
+            len -= n;
+        }
+        if (len == 0 || cnt == nvec)
+            break;
+        if (pos->node.next == &self->blocks) {
+            if (!block_new(self))
+                break;
+        }
+        pos = list_entry(pos->node.next, struct chainbuf_block, node);
+    }
+    return cnt;
+}
+
+size_t chainbuf_write_advance(chainbuf_t *self, size_t len)
+{
+    size_t retval = 0;
+
+    while (len && self->wblock) {
+        struct chainbuf_block *pos = self->wblock;
+        size_t n = self->block_size - pos->tail;
+        if (n > len)
+            n = len;
+        pos->tail += n;
+        len -= n;
+        retval += n;
+        if (pos->tail < self->block_size)
+            break;
+        if (pos->node.next == &self->blocks)
+            break;
+        self->wblock = list_entry(pos->node.next, struct chainbuf_block, node);
+    }
+
+    self->used += retval;
+    return retval;
+}
+
+size_t chainbuf_peek(chainbuf_t *self, void *ptr, size_t len)
+{
+    size_t retval = 0;
+    struct chainbuf_block *pos;
+    list_for_each_entry(pos, &self->blocks, node) {
+        if (retval == len || pos->tail == pos->head)
+            break;
+        size_t n = pos->tail - pos->head;
+        if (n > len - retval)
+            n = len - retval;
+        memcpy((char *)ptr + retval, pos->data + pos->head, n);
+        retval += n;
+    }
+    return retval;
+}
+
+size_t chainbuf_read(chainbuf_t *self, void *ptr, size_t len)
+{
+    size_t retval = chainbuf_peek(self, ptr, len);
+    chainbuf_read_advance(self, retval);
+    return retval;
+}
+
+size_t chainbuf_write(chainbuf_t *self, const void *ptr, size_t len)
+{
+    size_t retval = 0;
+
+    while (retval < len) {
+        struct chainbuf_vec vec[4];
+        int cnt = chainbuf_write_vec(self, len - retval, vec, 4);
+        if (cnt == 0)
+            break;
+        size_t nwrite = 0;
+        for (int i = 0; i < cnt; i++) {
+            memcpy(vec[i].base, (const char *)ptr + retval + nwrite, vec[i].len);
+            nwrite += vec[i].len;
+        }
+        retval += chainbuf_write_advance(self, nwrite);
+    }
+    return retval;
+}
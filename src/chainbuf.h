@@ -0,0 +1,55 @@
+#ifndef __CHAINBUF_H
+#define __CHAINBUF_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHAINBUF_DEFAULT_BLOCK_SIZE 4096
+
+/*
+ * A buffer of fixed-size blocks chained in a list. Writes append to the
+ * last block and take a new one when it is full, reads drain the first
+ * one and release it once empty, live bytes are never moved or copied
+ * to grow. The bytes are reached block by block through chainbuf_vec,
+ * in the same way as an iovec.
+ */
+typedef struct chainbuf chainbuf_t;
+
+struct chainbuf_vec {
+    char *base;
+    size_t len;
+};
+
+chainbuf_t *chainbuf_new(size_t block_size);
+void chainbuf_delete(chainbuf_t *self);
+
+size_t chainbuf_used(chainbuf_t *self);
+size_t chainbuf_nblocks(chainbuf_t *self);
+
+/*
+ * Fill vec with up to nvec segments of the used bytes in order, return
+ * the number of segments filled.
+ */
+int chainbuf_read_vec(chainbuf_t *self, struct chainbuf_vec *vec, int nvec);
+size_t chainbuf_read_advance(chainbuf_t *self, size_t len);
+
+/*
+ * Make room for len more bytes and fill vec with up to nvec segments of
+ * it in order, return the number of segments filled. The bytes written
+ * there are committed by chainbuf_write_advance.
+ */
+int chainbuf_write_vec(chainbuf_t *self, size_t len,
+                       struct chainbuf_vec *vec, int nvec);
+size_t chainbuf_write_advance(chainbuf_t *self, size_t len);
+
+size_t chainbuf_peek(chainbuf_t *self, void *ptr, size_t len);
+size_t chainbuf_read(chainbuf_t *self, void *ptr, size_t len);
+size_t chainbuf_write(chainbuf_t *self, const void *ptr, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
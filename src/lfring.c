@@ -0,0 +1,235 @@
+#include "lfring.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// keeps the fields before it off the next cache line
+#define LFRING_PAD(n, words) char pad##n[LFRING_CACHELINE - (words) * sizeof(size_t)]
+
+struct spsc_ring {
+    char *rawbuf;
+    size_t mask;
+    LFRING_PAD(0, 2);
+    size_t head; // bytes written, stored by the producer
+    size_t tail_cache; // the producer's last load of tail
+    LFRING_PAD(1, 2);
+    size_t tail; // bytes read, stored by the consumer
+    size_t head_cache; // the consumer's last load of head
+    LFRING_PAD(2, 2);
+};
+
+struct mpsc_cell {
+    size_t seq; // pos + 1 once filled, pos + size once drained
+    void *data;
+};
+
+struct mpsc_ring {
+    struct mpsc_cell *cells;
+    size_t mask;
+    LFRING_PAD(0, 2);
+    size_t head; // claimed by the producers with a cas
+    LFRING_PAD(1, 1);
+    size_t tail; // stored by the consumer
+    LFRING_PAD(2, 1);
+};
+
+static size_t round_pow2(size_t size)
+{
+    size_t n = 2;
+    while (n < size)
+        n <<= 1;
+    return n;
+}
+
+/*
+ * spsc_ring
+ */
+
+spsc_ring_t *spsc_ring_new(size_t size)
+{
+    size = round_pow2(size);
+
+    spsc_ring_t *self = calloc(1, sizeof(*self));
+    if (!self) return NULL;
+
+    self->rawbuf = malloc(size);
+    if (!self->rawbuf) {
+        free(self);
+        return NULL;
+    }
+
+    self->mask = size - 1;
+    return self;
+}
+
+void spsc_ring_delete(spsc_ring_t *self)
+{
+    free(self->rawbuf);
+    free(self);
+}
+
+size_t spsc_ring_size(spsc_ring_t *self)
+{
+    return self->mask + 1;
+}
+
+size_t spsc_ring_used(spsc_ring_t *self)
+{
+    size_t tail = __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE);
+    size_t head = __atomic_load_n(&self->head, __ATOMIC_ACQUIRE);
+    return head - tail;
+}
+
+size_t spsc_ring_spare(spsc_ring_t *self)
+{
+    return spsc_ring_size(self) - spsc_ring_used(self);
+}
+
+size_t spsc_ring_write(spsc_ring_t *self, const void *ptr, size_t len)
+{
+    size_t head = self->head;
+    size_t size = self->mask + 1;
+
+    if (size - (head - self->tail_cache) < len)
+        self->tail_cache = __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE);
+    size_t spare = size - (head - self->tail_cache);
+    if (len > spare)
+        len = spare;
+    if (len == 0)
+        return 0;
+
+    size_t offset = head & self->mask;
+    size_t right = size - offset;
+    if (right >= len) {
+        memcpy(self->rawbuf + offset, ptr, len);
+    } else {
+        memcpy(self->rawbuf + offset, ptr, right);
+        memcpy(self->rawbuf, (const char *)ptr + right, len - right);
+    }
+
+    __atomic_store_n(&self->head, head + len, __ATOMIC_RELEASE);
+    return len;
+}
+
+static size_t spsc_ring_copy_out(spsc_ring_t *self, void *ptr, size_t size)
+{
+    size_t tail = self->tail;
+
+    if (self->head_cache - tail < size)
+        self->head_cache = __atomic_load_n(&self->head, __ATOMIC_ACQUIRE);
+    size_t used = self->head_cache - tail;
+    if (size > used)
+        size = used;
+    if (size == 0)
+        return 0;
+
+    size_t offset = tail & self->mask;
+    size_t right = self->mask + 1 - offset;
+    if (right >= size) {
+        memcpy(ptr, self->rawbuf + offset, size);
+    } else {
+        memcpy(ptr, self->rawbuf + offset, right);
+        memcpy((char *)ptr + right, self->rawbuf, size - right);
+    }
+
+    return size;
+}
+
+size_t spsc_ring_peek(spsc_ring_t *self, void *ptr, size_t size)
+{
+    return spsc_ring_copy_out(self, ptr, size);
+}
+
+size_t spsc_ring_read(spsc_ring_t *self, void *ptr, size_t size)
+{
+    size = spsc_ring_copy_out(self, ptr, size);
+    if (size)
+        __atomic_store_n(&self->tail, self->tail + size, __ATOMIC_RELEASE);
+    return size;
+}
+
+/*
+ * mpsc_ring
+ */
+
+mpsc_ring_t *mpsc_ring_new(size_t size)
+{
+    size = round_pow2(size);
+
+    mpsc_ring_t *self = calloc(1, sizeof(*self));
+    if (!self) return NULL;
+
+    self->cells = malloc(size * sizeof(*self->cells));
+    if (!self->cells) {
+        free(self);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < size; i++)
+        self->cells[i].seq = i;
+    self->mask = size - 1;
+    return self;
+}
+
+void mpsc_ring_delete(mpsc_ring_t *self)
+{
+    free(self->cells);
+    free(self);
+}
+
+size_t mpsc_ring_size(mpsc_ring_t *self)
+{
+    return self->mask + 1;
+}
+
+size_t mpsc_ring_used(mpsc_ring_t *self)
+{
+    size_t tail = __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE);
+    size_t head = __atomic_load_n(&self->head, __ATOMIC_ACQUIRE);
+    return head - tail;
+}
+
+/*
+ * A producer claims the cell at head by moving head on with a cas, then
+ * publishes it by storing seq. The consumer owns tail alone, a cell is
+ * ready once its seq is tail + 1.
+ */
+int mpsc_ring_push(mpsc_ring_t *self, void *data)
+{
+    size_t pos = __atomic_load_n(&self->head, __ATOMIC_RELAXED);
+    struct mpsc_cell *cell;
+
+    for (;;) {
+        cell = &self->cells[pos & self->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(
+                    &self->head, &pos, pos + 1, 1,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&self->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->data = data;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int mpsc_ring_pop(mpsc_ring_t *self, void **data)
+{
+    size_t pos = self->tail;
+    struct mpsc_cell *cell = &self->cells[pos & self->mask];
+
+    if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1)
+        return -1;
+
+    *data = cell->data;
+    __atomic_store_n(&cell->seq, pos + self->mask + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&self->tail, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef __LFRING_H
+#define __LFRING_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LFRING_CACHELINE 64
+
+/*
+ * Lock-free rings to hand data between threads. size is rounded up to a
+ * power of two, positions are free-running counters masked into the
+ * ring, the producer and consumer sides live on separate cache lines.
+ */
+
+/*
+ * Single producer, single consumer byte ring. Exactly one thread may
+ * write and one thread may read at a time. The spare bytes only grow
+ * under the producer and the used bytes only grow under the consumer,
+ * so a producer that checks spsc_ring_spare first can write a record
+ * as a whole.
+ */
+typedef struct spsc_ring spsc_ring_t;
+
+spsc_ring_t *spsc_ring_new(size_t size);
+void spsc_ring_delete(spsc_ring_t *self);
+
+size_t spsc_ring_size(spsc_ring_t *self);
+size_t spsc_ring_used(spsc_ring_t *self);
+size_t spsc_ring_spare(spsc_ring_t *self);
+
+size_t spsc_ring_write(spsc_ring_t *self, const void *ptr, size_t len);
+size_t spsc_ring_peek(spsc_ring_t *self, void *ptr, size_t size);
+size_t spsc_ring_read(spsc_ring_t *self, void *ptr, size_t size);
+
+/*
+ * Multiple producer, single consumer ring of pointers, e.g. packets
+ * handed from worker threads back to the io thread. Any thread may push,
+ * exactly one thread may pop.
+ */
+typedef struct mpsc_ring mpsc_ring_t;
+
+mpsc_ring_t *mpsc_ring_new(size_t size);
+void mpsc_ring_delete(mpsc_ring_t *self);
+
+size_t mpsc_ring_size(mpsc_ring_t *self);
+size_t mpsc_ring_used(mpsc_ring_t *self);
+
+// return 0 on success, -1 if the ring is full
+int mpsc_ring_push(mpsc_ring_t *self, void *data);
+// return 0 on success, -1 if the ring is empty
+int mpsc_ring_pop(mpsc_ring_t *self, void **data);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,118 @@
+#include "mempool.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMPOOL_ALIGN 16
+#define MEMPOOL_ROUNDUP(x) (((x) + MEMPOOL_ALIGN - 1) & ~(size_t)(MEMPOOL_ALIGN - 1))
+
+struct mempool_slab {
+    struct mempool_slab *next;
+};
+
+struct mempool_obj {
+    struct mempool_obj *next;
+};
+
+struct mempool {
+    size_t obj_size;
+    size_t slab_objs;
+    struct mempool_slab *slabs;
+    struct mempool_obj *free_list;
+    size_t used;
+    size_t peak;
+    size_t capacity;
+};
+
+mempool_t *mempool_new(size_t obj_size, size_t slab_objs)
+{
+    if (slab_objs == 0)
+        slab_objs = MEMPOOL_DEFAULT_SLAB_OBJS;
+
+    mempool_t *self = (mempool_t *)calloc(sizeof(mempool_t), 1);
+    if (!self) return NULL;
+
+    if (obj_size < sizeof(struct mempool_obj))
+        obj_size = sizeof(struct mempool_obj);
+    self->obj_size = MEMPOOL_ROUNDUP(obj_size);
+    self->slab_objs = slab_objs;
+    self->slabs = NULL;
+    self->free_list = NULL;
+
+    return self;
+}
+
+void mempool_delete(mempool_t *self)
+{
+    if (self) {
+        struct mempool_slab *pos = self->slabs;
+        while (pos) {
+            struct mempool_slab *next = pos->next;
+            free(pos);
+            pos = next;
+        }
+        free(self);
+    }
+}
+
+static int mempool_grow(mempool_t *self)
+{
+    size_t hdr = MEMPOOL_ROUNDUP(sizeof(struct mempool_slab));
+    struct mempool_slab *slab = malloc(hdr + self->obj_size * self->slab_objs);
+    if (!slab) return -1;
+
+    slab->next = self->slabs;
+    self->slabs = slab;
+
+    char *objs = (char *)slab + hdr;
+    for (size_t i = self->slab_objs; i > 0; i--) {
+        struct mempool_obj *obj = (struct mempool_obj *)
+            (objs + (i - 1) * self->obj_size);
+        obj->next = self->free_list;
+        self->free_list = obj;
+    }
+
+    self->capacity += self->slab_objs;
+    return 0;
+}
+
+void *mempool_alloc(mempool_t *self)
+{
+    if (self->free_list == NULL && mempool_grow(self) != 0)
+        return NULL;
+
+    struct mempool_obj *obj = self->free_list;
+    self->free_list = obj->next;
+
+    self->used++;
+    if (self->used > self->peak)
+        self->peak = self->used;
+    return obj;
+}
+
+void mempool_free(mempool_t *self, void *obj)
+{
+    if (obj == NULL)
+        return;
+
+    assert(self->used);
+    struct mempool_obj *pos = (struct mempool_obj *)obj;
+    pos->next = self->free_list;
+    self->free_list = pos;
+    self->used--;
+}
+
+size_t mempool_used(mempool_t *self)
+{
+    return self->used;
+}
+
+size_t mempool_peak(mempool_t *self)
+{
+    return self->peak;
+}
+
+size_t mempool_capacity(mempool_t *self)
+{
+    return self->capacity;
+}
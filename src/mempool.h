@@ -0,0 +1,32 @@
+#ifndef __MEMPOOL_H
+#define __MEMPOOL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MEMPOOL_DEFAULT_SLAB_OBJS 64
+
+/*
+ * Fixed-size object pool, objects are carved from slabs and recycled
+ * through a free list, slabs are only released by mempool_delete.
+ */
+
+typedef struct mempool mempool_t;
+
+mempool_t *mempool_new(size_t obj_size, size_t slab_objs);
+void mempool_delete(mempool_t *self);
+
+void *mempool_alloc(mempool_t *self);
+void mempool_free(mempool_t *self, void *obj);
+
+size_t mempool_used(mempool_t *self);
+size_t mempool_peak(mempool_t *self);
+size_t mempool_capacity(mempool_t *self);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,61 @@
+#include "apix-group.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "apix-private.h"
+#include "task.h"
+
+// a nonzero return ends the task
+static int shard_run(void *arg)
+{
+    struct apibus *bus = arg;
+    apibus_poll_timeout(bus, APIBUS_GROUP_POLL_TIMEOUT);
+    return __atomic_load_n(&bus->stop, __ATOMIC_ACQUIRE);
+}
+
+int apibus_group_start(struct apibus_group *group)
+{
+    if (group->tasks)
+        return -1;
+
+    group->tasks = calloc(group->nshards, sizeof(*group->tasks));
+    if (group->tasks == NULL)
+        return -1;
+
+    for (int i = 0; i < group->nshards; i++) {
+        __atomic_store_n(&group->shards[i]->stop, 0, __ATOMIC_RELEASE);
+        char name[TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "apibus-shard-%d", i);
+        group->tasks[i] = task_new(name, shard_run, group->shards[i]);
+        if (group->tasks[i] == NULL || task_start(group->tasks[i]) != 0) {
+            free(group->tasks[i]);
+            group->tasks[i] = NULL;
+            apibus_group_stop(group);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * All shards are told to stop before any is woken, so a shard blocked in
+ * its poll sees the stop once woken, then they are joined in turn.
+ */
+void apibus_group_stop(struct apibus_group *group)
+{
+    if (group->tasks == NULL)
+        return;
+
+    for (int i = 0; i < group->nshards; i++)
+        __atomic_store_n(&group->shards[i]->stop, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < group->nshards; i++)
+        apibus_wake(group->shards[i]);
+
+    for (int i = 0; i < group->nshards; i++) {
+        if (group->tasks[i])
+            task_destroy(group->tasks[i]);
+    }
+
+    free(group->tasks);
+    group->tasks = NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef __EXT_APIX_GROUP_H
+#define __EXT_APIX_GROUP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APIBUS_GROUP_POLL_TIMEOUT 100 /*ms*/
+
+struct apibus_group;
+
+/*
+ * Poll each shard of the group in a task of its own. The shards must not
+ * be polled or changed by other threads until apibus_group_stop returns.
+ */
+int apibus_group_start(struct apibus_group *group);
+void apibus_group_stop(struct apibus_group *group);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -2,12 +2,18 @@
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#if defined __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 
 struct ringbuf {
     char *rawbuf;
     size_t size;
     size_t offset_in;
     size_t offset_out;
+    int mirrored; // rawbuf is mapped twice, rawbuf[size + i] is rawbuf[i]
 };
 
 ringbuf_t *ringbuf_new(size_t size)
@@ -31,14 +37,82 @@ ringbuf_t *ringbuf_new(size_t size)
     return self;
 }
 
+#if defined __linux__ && defined SYS_memfd_create
+/*
+ * Reserve twice the size of address space, then map the same memfd pages
+ * over both halves, a copy running past the end lands at the start.
+ */
+ringbuf_t *ringbuf_new_mirrored(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    if (size == 0)
+        size = RINGBUF_DEFAULT_SIZE;
+    size = (size + page - 1) / page * page;
+
+    int fd = syscall(SYS_memfd_create, "ringbuf", 1/*MFD_CLOEXEC*/);
+    if (fd == -1)
+        return NULL;
+    if (ftruncate(fd, size) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    char *base = mmap(NULL, size << 1, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    if (mmap(base, size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + size, size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, size << 1);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    ringbuf_t *self = (ringbuf_t*)calloc(sizeof(ringbuf_t), 1);
+    if (!self) {
+        munmap(base, size << 1);
+        return NULL;
+    }
+
+    self->rawbuf = base;
+    self->size = size;
+    self->offset_in = 0;
+    self->offset_out = 0;
+    self->mirrored = 1;
+
+    return self;
+}
+#else
+ringbuf_t *ringbuf_new_mirrored(size_t size)
+{
+    (void)size;
+    return NULL;
+}
+#endif
+
 void ringbuf_delete(ringbuf_t *self)
 {
     if (self) {
-        free(self->rawbuf);
+#if defined __linux__
+        if (self->mirrored)
+            munmap(self->rawbuf, self->size << 1);
+        else
+#endif
+            free(self->rawbuf);
         free(self);
     }
 }
 
+int ringbuf_is_mirrored(ringbuf_t *self)
+{
+    return self->mirrored;
+}
+
 size_t ringbuf_size(ringbuf_t *self)
 {
     return self->size;
@@ -57,16 +131,33 @@ size_t ringbuf_spare(ringbuf_t *self)
     return self->size - ringbuf_used(self);
 }
 
-static char *ringbuf_write_pos(ringbuf_t *self)
+char *ringbuf_write_pos(ringbuf_t *self)
 {
     return self->rawbuf + self->offset_in;
 }
 
-static char *ringbuf_read_pos(ringbuf_t *self)
+char *ringbuf_read_pos(ringbuf_t *self)
 {
     return self->rawbuf + self->offset_out;
 }
 
+size_t ringbuf_read_contig(ringbuf_t *self)
+{
+    if (self->mirrored || self->offset_in >= self->offset_out)
+        return ringbuf_used(self);
+    return self->size - self->offset_out;
+}
+
+size_t ringbuf_write_contig(ringbuf_t *self)
+{
+    // one byte is kept, a full ring would read as an empty one
+    size_t spare = ringbuf_spare(self) - 1;
+    if (self->mirrored || self->offset_in < self->offset_out)
+        return spare;
+    size_t right = self->size - self->offset_in;
+    return right < spare ? right : spare;
+}
+
 void ringbuf_write_advance(ringbuf_t *self, size_t len)
 {
     assert(ringbuf_spare(self) >= len);
@@ -82,34 +173,17 @@ void ringbuf_read_advance(ringbuf_t *self, size_t len)
 size_t ringbuf_write(ringbuf_t *self, const void *ptr, size_t len)
 {
     assert(len < self->size);
-    size_t cpy_cnt = 0;
-
-    if (self->offset_in >= self->offset_out) {
-        size_t spare_right = self->size - self->offset_in;
-        size_t spare_left = self->offset_out;
-        if (len <= spare_right) {
-            memcpy(ringbuf_write_pos(self), ptr, len);
-            cpy_cnt += len;
-        } else {
-            memcpy(ringbuf_write_pos(self), ptr, spare_right);
-            cpy_cnt += spare_right;
-            if (len - spare_right <= spare_left) {
-                memcpy(self->rawbuf, ptr + cpy_cnt, len - spare_right);
-                cpy_cnt += len - spare_right;
-            } else {
-                memcpy(self->rawbuf, ptr + cpy_cnt, spare_left);
-                cpy_cnt += spare_left;
-            }
-        }
+
+    // one byte is kept, see ringbuf_write_contig
+    size_t spare = ringbuf_spare(self) - 1;
+    size_t cpy_cnt = len <= spare ? len : spare;
+    size_t right = self->mirrored ? cpy_cnt : self->size - self->offset_in;
+
+    if (cpy_cnt <= right) {
+        memcpy(ringbuf_write_pos(self), ptr, cpy_cnt);
     } else {
-        size_t spare = self->offset_out - self->offset_in;
-        if (len <= spare) {
-            memcpy(ringbuf_write_pos(self), ptr, len);
-            cpy_cnt += len;
-        } else {
-            memcpy(ringbuf_write_pos(self), ptr, spare);
-            cpy_cnt += spare;
-        }
+        memcpy(ringbuf_write_pos(self), ptr, right);
+        memcpy(self->rawbuf, (const char *)ptr + right, cpy_cnt - right);
     }
 
     ringbuf_write_advance(self, cpy_cnt);
@@ -122,14 +196,15 @@ size_t ringbuf_peek(ringbuf_t *self, void *ptr, size_t size)
     if (size < cpy_cnt)
         cpy_cnt = size;
 
-    if (self->offset_in >= self->offset_out) {
+    if (self->mirrored || self->offset_in >= self->offset_out) {
         memcpy(ptr, ringbuf_read_pos(self), cpy_cnt);
     }
     else {
         size_t cpy_right = self->size - self->offset_out;
-        size_t cpy_left = cpy_cnt - cpy_right;
+        if (cpy_right > cpy_cnt)
+            cpy_right = cpy_cnt;
         memcpy(ptr, ringbuf_read_pos(self), cpy_right);
-        memcpy(ptr + cpy_right, self->rawbuf, cpy_left);
+        memcpy(ptr + cpy_right, self->rawbuf, cpy_cnt - cpy_right);
     }
 
     return cpy_cnt;
@@ -14,10 +14,25 @@ typedef struct ringbuf ringbuf_t;
 ringbuf_t *ringbuf_new(size_t size);
 void ringbuf_delete(ringbuf_t *self);
 
+/*
+ * A ring whose pages are mapped twice back to back, so the used bytes at
+ * ringbuf_read_pos and the spare bytes at ringbuf_write_pos are always
+ * contiguous. size is rounded up to pages. Linux only, NULL elsewhere or
+ * if the mapping fails.
+ */
+ringbuf_t *ringbuf_new_mirrored(size_t size);
+int ringbuf_is_mirrored(ringbuf_t *self);
+
 size_t ringbuf_size(ringbuf_t *self);
 size_t ringbuf_used(ringbuf_t *self);
 size_t ringbuf_spare(ringbuf_t *self);
 
+char *ringbuf_read_pos(ringbuf_t *self);
+char *ringbuf_write_pos(ringbuf_t *self);
+// bytes at read_pos or write_pos reachable without wrapping
+size_t ringbuf_read_contig(ringbuf_t *self);
+size_t ringbuf_write_contig(ringbuf_t *self);
+
 void ringbuf_write_advance(ringbuf_t *self, size_t len);
 void ringbuf_read_advance(ringbuf_t *self, size_t len);
 
@@ -8,307 +8,657 @@
 #include "stddefx.h"
 #include "crc16.h"
 
-#define SEQNO_MAX_LEN 32
-#define LENGTH_MAX_LEN 32
-#define SRCID_MAX_LEN 32
+#if defined __SSE2__
+#include <emmintrin.h>
+#endif
+
+static int srrp_crc16_trailer = 0;
+
+int srrp_set_crc16(int enable)
+{
+    return __atomic_exchange_n(&srrp_crc16_trailer, enable, __ATOMIC_RELAXED);
+}
 
 void srrp_free(struct srrp_packet *pac)
 {
     free(pac);
 }
 
-static struct srrp_packet *
-__srrp_read_one_request(const char *buf)
+static int srrp_is_leader(char c)
 {
-    assert(buf[0] == SRRP_REQUEST_LEADER);
+    return c == SRRP_REQUEST_LEADER ||
+        c == SRRP_RESPONSE_LEADER ||
+        c == SRRP_SUBSCRIBE_LEADER ||
+        c == SRRP_UNSUBSCRIBE_LEADER ||
+        c == SRRP_PUBLISH_LEADER ||
+        c == SRRP_ACK_LEADER;
+}
 
-    char leader, seat;
-    uint32_t seqno, len, srcid;
+static int srrp_hexval(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
 
-    // FIXME: shall we use "%c%x,%c,%4x,%4x:%[^{}]%s" to parse header and data ?
-    int cnt = sscanf(buf, "%c%x,%c,%4x,%4x:", &leader, &seqno, &seat, &len, &srcid);
-    if (cnt != 5) return NULL;
+// a leader followed by a digit, or the binary marker followed by a leader
+static int srrp_is_boundary(const char *buf, size_t len, size_t i)
+{
+    if (srrp_is_leader(buf[i]))
+        return i + 1 == len || isdigit((unsigned char)buf[i + 1]);
+    if (buf[i] == SRRP_BINARY_MARKER)
+        return i + 1 == len || srrp_is_leader(buf[i + 1]);
+    return 0;
+}
 
-    const char *header_delimiter = strstr(buf, ":/");
-    const char *data_delimiter = strstr(buf, "?{");
-    if (header_delimiter == NULL || data_delimiter == NULL)
-        return NULL;
+#if defined __SSE2__
+/*
+ * Compare 16 bytes against every leader and the binary marker at once,
+ * only the hits are checked for the byte that must follow.
+ */
+static size_t srrp_scan_leader(const char *buf, size_t len, size_t i)
+{
+    const __m128i req = _mm_set1_epi8(SRRP_REQUEST_LEADER);
+    const __m128i resp = _mm_set1_epi8(SRRP_RESPONSE_LEADER);
+    const __m128i sub = _mm_set1_epi8(SRRP_SUBSCRIBE_LEADER);
+    const __m128i unsub = _mm_set1_epi8(SRRP_UNSUBSCRIBE_LEADER);
+    const __m128i pub = _mm_set1_epi8(SRRP_PUBLISH_LEADER);
+    const __m128i ack = _mm_set1_epi8(SRRP_ACK_LEADER);
+    const __m128i marker = _mm_set1_epi8(SRRP_BINARY_MARKER);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i a = _mm_or_si128(_mm_cmpeq_epi8(v, req), _mm_cmpeq_epi8(v, resp));
+        __m128i b = _mm_or_si128(_mm_cmpeq_epi8(v, sub), _mm_cmpeq_epi8(v, unsub));
+        __m128i c = _mm_or_si128(_mm_cmpeq_epi8(v, pub), _mm_cmpeq_epi8(v, ack));
+        __m128i hit = _mm_or_si128(_mm_or_si128(a, b),
+                                   _mm_or_si128(c, _mm_cmpeq_epi8(v, marker)));
+        for (uint32_t mask = _mm_movemask_epi8(hit); mask; mask &= mask - 1) {
+            size_t j = i + __builtin_ctz(mask);
+            if (srrp_is_boundary(buf, len, j))
+                return j;
+        }
+    }
+    return i;
+}
+#endif
 
-    struct srrp_packet *pac = calloc(1, sizeof(*pac) + len);
-    memcpy(pac->raw, buf, len);
-    pac->leader = leader;
-    pac->seat = seat;
-    pac->seqno = seqno;
-    pac->len = len;
-    pac->srcid = srcid;
+/*
+ * offset of the next byte in buf[1, len) which may begin a packet,
+ * len if there is none
+ */
+static size_t srrp_next_leader(const char *buf, size_t len)
+{
+    size_t i = 1;
 
-    const char *header = header_delimiter + 1;
-    const char *data = data_delimiter + 1;
-    pac->header_len = data_delimiter - header;
-    memcpy((void *)pac->header, header, pac->header_len);
-    pac->data = pac->raw + (data - buf);
-    pac->data_len = buf + strlen(buf) - data;
+#if defined __SSE2__
+    // up to the first hit, the tail is left to the loop below
+    i = srrp_scan_leader(buf, len, i);
+#endif
 
-    int retval =  3 + 2 + 5 + 5 + pac->header_len + 1 + pac->data_len + 1/*stop*/;
-    if (retval != pac->len) {
-        free(pac);
-        return NULL;
+    for (; i < len; i++) {
+        if (srrp_is_boundary(buf, len, i))
+            return i;
     }
-    return pac;
+    return len;
 }
 
-static struct srrp_packet *
-__srrp_read_one_response(const char *buf)
+static uint16_t srrp_get_le16(const char *p)
 {
-    assert(buf[0] == SRRP_RESPONSE_LEADER);
+    return (uint8_t)p[0] | (uint8_t)p[1] << 8;
+}
 
-    char leader, seat;
-    uint32_t seqno, len, srcid, reqcrc16;
+static void srrp_put_le16(char *p, uint16_t val)
+{
+    p[0] = val & 0xff;
+    p[1] = val >> 8;
+}
 
-    // FIXME: shall we use "%c%x,%c,%4x,%4x:%x%[^{}]%s" to parse header and data ?
-    int cnt = sscanf(buf, "%c%x,%c,%4x,%4x,%x:/",
-                     &leader, &seqno, &seat, &len, &srcid, &reqcrc16);
-    if (cnt != 6) return NULL;
+#define PARSE_OK 1
+#define PARSE_AGAIN 0
+#define PARSE_ERR -1
 
-    const char *header_delimiter = strstr(buf, ":/");
-    const char *data_delimiter = strstr(buf, "?{");
-    if (header_delimiter == NULL || data_delimiter == NULL)
-        return NULL;
+static int srrp_parse_hex(const char *buf, size_t len, size_t *pos,
+                          int max_digits, char delim, uint32_t *val)
+{
+    uint32_t retval = 0;
+    int digits = 0;
+    size_t i = *pos;
+
+    for (;; i++) {
+        if (i == len)
+            return PARSE_AGAIN;
+        int h = srrp_hexval(buf[i]);
+        if (h == -1)
+            break;
+        if (++digits > max_digits)
+            return PARSE_ERR;
+        retval = retval << 4 | h;
+    }
 
-    struct srrp_packet *pac = calloc(1, sizeof(*pac) + len);
-    memcpy(pac->raw, buf, len);
-    pac->leader = leader;
-    pac->seat = seat;
-    pac->seqno = seqno;
-    pac->len = len;
-    pac->srcid = srcid;
-    pac->reqcrc16 = reqcrc16;
+    if (digits == 0 || buf[i] != delim)
+        return PARSE_ERR;
 
-    const char *header = header_delimiter + 1;
-    const char *data = data_delimiter + 1;
-    pac->header_len = data_delimiter - header;
-    memcpy((void *)pac->header, header, pac->header_len);
-    pac->data = pac->raw + (data - buf);
-    pac->data_len = buf + strlen(buf) - data;
+    *pos = i + 1;
+    *val = retval;
+    return PARSE_OK;
+}
 
-    int retval =  3 + 2 + 5 + 5 + 5 + pac->header_len + 1 + pac->data_len + 1/*stop*/;
-    if (retval != pac->len) {
-        free(pac);
-        return NULL;
+static int srrp_is_seat(char c)
+{
+    return c == SRRP_BEGIN_PACKET || c == SRRP_MID_PACKET || c == SRRP_END_PACKET;
+}
+
+static int __srrp_parse_binary(const char *buf, size_t len, struct srrp_view *pac)
+{
+    if (len < SRRP_BINARY_HEADER_SIZE)
+        return PARSE_AGAIN;
+    if (!srrp_is_leader(buf[1]) || !srrp_is_seat(buf[2]) ||
+        (buf[3] & ~SRRP_BINARY_FLAG_CRC16))
+        return PARSE_ERR;
+
+    size_t trailer = buf[3] & SRRP_BINARY_FLAG_CRC16 ? 2 : 0;
+    uint16_t pac_len = srrp_get_le16(buf + 6);
+    uint16_t header_len = srrp_get_le16(buf + 12);
+    uint16_t data_len = srrp_get_le16(buf + 14);
+    if (pac_len > SRRP_LENGTH_MAX || header_len >= SRRP_HEADER_LEN ||
+        pac_len != SRRP_BINARY_HEADER_SIZE + header_len + data_len + 1 + trailer ||
+        header_len + data_len == 0)
+        return PARSE_ERR;
+    if (pac_len > len)
+        return PARSE_AGAIN;
+
+    const char *header = buf + SRRP_BINARY_HEADER_SIZE;
+    const char *data = header + header_len;
+    if (data[data_len] != 0 || memchr(header, 0, header_len + data_len))
+        return PARSE_ERR;
+    if (trailer && crc16(buf, pac_len - trailer) !=
+        srrp_get_le16(buf + pac_len - trailer))
+        return PARSE_ERR;
+
+    pac->leader = buf[1];
+    pac->seat = buf[2];
+    pac->seqno = srrp_get_le16(buf + 4);
+    pac->len = pac_len;
+    pac->srcid = srrp_get_le16(buf + 8);
+    pac->reqcrc16 = srrp_get_le16(buf + 10);
+    pac->raw = buf;
+
+    // same rules for single packets and fragments as the text framing
+    if (header_len) {
+        if (header[0] != '/' || pac->seat != SRRP_END_PACKET)
+            return PARSE_ERR;
+        // the text framing would split header and data at the first "?{"
+        if (data_len == 0 || data[0] != '{')
+            return PARSE_ERR;
+        for (size_t i = 1; i < header_len; i++) {
+            if (header[i] == SRRP_DATA_DELIMITER &&
+                (i + 1 == header_len || header[i + 1] == '{'))
+                return PARSE_ERR;
+        }
+        pac->header = header;
+        pac->header_len = header_len;
+    } else {
+        if (pac->seat == SRRP_END_PACKET && pac->seqno == 0)
+            return PARSE_ERR;
+        if (pac->seat == SRRP_BEGIN_PACKET && data[0] != '/')
+            return PARSE_ERR;
+        pac->header = NULL;
+        pac->header_len = 0;
     }
-    return pac;
+    pac->data = data;
+    pac->data_len = data_len;
+    return PARSE_OK;
 }
 
-static struct srrp_packet *
-__srrp_read_one_subpub(const char *buf)
+/*
+ * One pass over at most len bytes:
+ *   leader, seqno, seat, len, [srcid, [reqcrc16]] => header start,
+ *   then header up to the first "?{", data up to the null at len - 1.
+ */
+static int __srrp_parse(const char *buf, size_t len, struct srrp_view *pac)
 {
-    assert(buf[0] == SRRP_SUBSCRIBE_LEADER ||
-           buf[0] == SRRP_UNSUBSCRIBE_LEADER ||
-           buf[0] == SRRP_PUBLISH_LEADER);
+    size_t pos = 0;
+    uint32_t seqno = 0, pac_len = 0, srcid = 0, reqcrc16 = 0;
+    int rc;
+
+    if (len == 0)
+        return PARSE_AGAIN;
+    if (buf[0] == SRRP_BINARY_MARKER)
+        return __srrp_parse_binary(buf, len, pac);
+    if (!srrp_is_leader(buf[0]))
+        return PARSE_ERR;
+    pac->leader = buf[pos++];
+
+    if ((rc = srrp_parse_hex(buf, len, &pos, 4, ',', &seqno)) != PARSE_OK)
+        return rc;
+
+    if (pos + 2 > len)
+        return PARSE_AGAIN;
+    if (!srrp_is_seat(buf[pos]) || buf[pos + 1] != ',')
+        return PARSE_ERR;
+    pac->seat = buf[pos];
+    pos += 2;
+
+    if (pac->leader == SRRP_REQUEST_LEADER) {
+        if ((rc = srrp_parse_hex(buf, len, &pos, 4, ',', &pac_len)) != PARSE_OK)
+            return rc;
+        if ((rc = srrp_parse_hex(buf, len, &pos, 4, ':', &srcid)) != PARSE_OK)
+            return rc;
+    } else if (pac->leader == SRRP_RESPONSE_LEADER) {
+        if ((rc = srrp_parse_hex(buf, len, &pos, 4, ',', &pac_len)) != PARSE_OK)
+            return rc;
+        if ((rc = srrp_parse_hex(buf, len, &pos, 4, ',', &srcid)) != PARSE_OK)
+            return rc;
+        if ((rc = srrp_parse_hex(buf, len, &pos, 4, ':', &reqcrc16)) != PARSE_OK)
+            return rc;
+    } else {
+        if ((rc = srrp_parse_hex(buf, len, &pos, 4, ':', &pac_len)) != PARSE_OK)
+            return rc;
+    }
 
-    char leader, seat;
-    uint32_t seqno, len;
+    // the smallest body is one byte plus the stop null
+    if (pac_len < pos + 2 || pac_len > SRRP_LENGTH_MAX)
+        return PARSE_ERR;
+    if (pac_len > len)
+        return PARSE_AGAIN;
+    if (buf[pac_len - 1] != 0)
+        return PARSE_ERR;
+
+    // the body has no null, one before the last ends it and a trailer follows
+    size_t stop = pac_len - 1;
+    if (pac_len >= pos + 2 + SRRP_CRC16_TRAILER_LEN &&
+        buf[pac_len - 1 - SRRP_CRC16_TRAILER_LEN] == 0) {
+        stop = pac_len - 1 - SRRP_CRC16_TRAILER_LEN;
+        size_t trailer_pos = stop + 1;
+        uint32_t crc;
+        if (srrp_parse_hex(buf, pac_len, &trailer_pos, 4, 0, &crc) != PARSE_OK ||
+            trailer_pos != pac_len || crc != crc16(buf, stop + 1))
+            return PARSE_ERR;
+    }
+    if (stop < pos + 1 || memchr(buf + pos, 0, stop - pos))
+        return PARSE_ERR;
 
-    // FIXME: shall we use "%c%x,%c,%4x:%[^{}]%s" to parse header and data ?
-    int cnt = sscanf(buf, "%c%x,%c,%4x:", &leader, &seqno, &seat, &len);
-    if (cnt != 4) return NULL;
+    pac->seqno = seqno;
+    pac->len = pac_len;
+    pac->srcid = srcid;
+    pac->reqcrc16 = reqcrc16;
+    pac->raw = buf;
+
+    /*
+     * A single packet is seated '$' with seqno 0 and holds the whole
+     * header?data. Any other packet may be a fragment, see
+     * srrp_write_stream, its slice of header?data is left in data.
+     */
+    if (srrp_parse_body(pac, buf + pos, stop - pos) == 0 &&
+        pac->seat == SRRP_END_PACKET)
+        return PARSE_OK;
+    if (pac->seat == SRRP_END_PACKET && seqno == 0)
+        return PARSE_ERR;
+    if (pac->seat == SRRP_BEGIN_PACKET && buf[pos] != '/')
+        return PARSE_ERR;
+
+    pac->header = NULL;
+    pac->header_len = 0;
+    pac->data = buf + pos;
+    pac->data_len = stop - pos;
+    return PARSE_OK;
+}
 
-    const char *header_delimiter = strstr(buf, ":/");
-    const char *data_delimiter = strstr(buf, "?{");
-    if (header_delimiter == NULL || data_delimiter == NULL)
-        return NULL;
+int srrp_parse_body(struct srrp_view *view, const char *body, size_t len)
+{
+    // the smallest body is "/?{"
+    if (len < 3 || body[0] != '/')
+        return -1;
+
+    size_t data_delimiter = 0;
+    for (size_t i = 1; i + 1 < len; i++) {
+        if (body[i] == SRRP_DATA_DELIMITER && body[i + 1] == '{') {
+            data_delimiter = i;
+            break;
+        }
+    }
+    if (data_delimiter == 0 || data_delimiter >= SRRP_HEADER_LEN)
+        return -1;
+
+    view->header = body;
+    view->header_len = data_delimiter;
+    view->data = body + data_delimiter + 1;
+    view->data_len = len - (data_delimiter + 1);
+    return 0;
+}
 
-    struct srrp_packet *pac = calloc(1, sizeof(*pac) + len);
-    memcpy(pac->raw, buf, len);
-    pac->leader = leader;
-    pac->seat = seat;
-    pac->seqno = seqno;
-    pac->len = len;
+int srrp_parse_view(struct srrp_view *view, const char *buf, size_t len,
+                    size_t *consumed)
+{
+    int rc = __srrp_parse(buf, len, view);
+
+    if (rc == PARSE_AGAIN) {
+        *consumed = 0;
+        return -1;
+    } else if (rc == PARSE_ERR) {
+        *consumed = srrp_next_leader(buf, len);
+        return -1;
+    }
 
-    const char *header = header_delimiter + 1;
-    const char *data = data_delimiter + 1;
-    pac->header_len = data_delimiter - header;
-    memcpy((void *)pac->header, header, pac->header_len);
-    pac->data = pac->raw + (data - buf);
-    pac->data_len = buf + strlen(buf) - data;
+    *consumed = view->len;
+    return 0;
+}
 
-    int retval =  3 + 2 + 5 + pac->header_len + 1 + pac->data_len + 1/*stop*/;
-    if (retval != pac->len) {
+struct srrp_packet *
+srrp_parse(const char *buf, size_t len, size_t *consumed)
+{
+    struct srrp_view view;
+    if (srrp_parse_view(&view, buf, len, consumed) != 0)
         return NULL;
-    }
+
+    struct srrp_packet *pac = calloc(1, sizeof(*pac) + view.len);
+    assert(pac);
+    memcpy(pac->raw, buf, view.len);
+    pac->leader = view.leader;
+    pac->seat = view.seat;
+    pac->seqno = view.seqno;
+    pac->len = view.len;
+    pac->srcid = view.srcid;
+    pac->reqcrc16 = view.reqcrc16;
+    if (view.header_len)
+        memcpy((void *)pac->header, view.header, view.header_len);
+    pac->header_len = view.header_len;
+    pac->data = pac->raw + (view.data - buf);
+    pac->data_len = view.data_len;
     return pac;
 }
 
 struct srrp_packet *
 srrp_read_one_packet(const char *buf)
 {
-    const char *leader = buf;
+    size_t consumed;
+    return srrp_parse(buf, strlen(buf) + 1, &consumed);
+}
+
+static int srrp_write_prefix(char *buf, size_t size, char leader, char seat,
+                             uint16_t seqno, uint32_t len, uint16_t srcid,
+                             uint16_t reqcrc16)
+{
+    if (leader == SRRP_REQUEST_LEADER)
+        return snprintf(buf, size, ">%x,%c,%.4x,%.4x:", seqno, seat, len, srcid);
+    else if (leader == SRRP_RESPONSE_LEADER)
+        return snprintf(buf, size, "<%x,%c,%.4x,%.4x,%.4x:",
+                        seqno, seat, len, srcid, reqcrc16);
+    else
+        return snprintf(buf, size, "%c%x,%c,%.4x:", leader, seqno, seat, len);
+}
 
-    if (*leader == SRRP_REQUEST_LEADER)
-        return __srrp_read_one_request(buf);
-    else if (*leader == SRRP_RESPONSE_LEADER)
-        return __srrp_read_one_response(buf);
-    else if (*leader == SRRP_SUBSCRIBE_LEADER ||
-             *leader == SRRP_UNSUBSCRIBE_LEADER ||
-             *leader == SRRP_PUBLISH_LEADER)
-        return __srrp_read_one_subpub(buf);
+/*
+ * Encode one packet into buf, a fragment has no header and carries its
+ * slice of header?data in data. The crc16 trailer is appended when
+ * enabled by srrp_set_crc16 or SRRP_FRAMING_CRC16. Return its length and
+ * the offset of data in buf, -1 if it does not fit.
+ */
+static int srrp_encode(char *buf, size_t size, int framing, char leader,
+                       char seat, uint16_t seqno, uint16_t srcid,
+                       uint16_t reqcrc16, const char *header, size_t header_len,
+                       const char *data, size_t data_len, size_t *data_offset)
+{
+    size_t body_len = header ? header_len + 1 + data_len : data_len;
+    size_t len;
+    char *p;
+    int trailer = (framing & SRRP_FRAMING_CRC16) ||
+        __atomic_load_n(&srrp_crc16_trailer, __ATOMIC_RELAXED);
+    framing &= ~SRRP_FRAMING_CRC16;
+
+    if (framing == SRRP_FRAMING_BINARY) {
+        len = SRRP_BINARY_HEADER_SIZE + (header ? header_len : 0) + data_len + 1;
+        if (trailer)
+            len += 2;
+        if (len > size || len > SRRP_LENGTH_MAX)
+            return -1;
+        buf[0] = SRRP_BINARY_MARKER;
+        buf[1] = leader;
+        buf[2] = seat;
+        buf[3] = trailer ? SRRP_BINARY_FLAG_CRC16 : 0;
+        srrp_put_le16(buf + 4, seqno);
+        srrp_put_le16(buf + 6, len);
+        srrp_put_le16(buf + 8, srcid);
+        srrp_put_le16(buf + 10, reqcrc16);
+        srrp_put_le16(buf + 12, header ? header_len : 0);
+        srrp_put_le16(buf + 14, data_len);
+        p = buf + SRRP_BINARY_HEADER_SIZE;
+        if (header) {
+            memcpy(p, header, header_len);
+            p += header_len;
+        }
+    } else {
+        // len is always written with 4 digits, so 0 gives the final width
+        char prefix[32];
+        len = srrp_write_prefix(prefix, sizeof(prefix), leader, seat, seqno, 0,
+                                srcid, reqcrc16) + body_len + 1;
+        if (trailer)
+            len += SRRP_CRC16_TRAILER_LEN;
+        if (len > size || len > SRRP_LENGTH_MAX)
+            return -1;
+        p = buf + srrp_write_prefix(buf, size, leader, seat, seqno, len,
+                                    srcid, reqcrc16);
+        if (header) {
+            memcpy(p, header, header_len);
+            p += header_len;
+            *p++ = SRRP_DATA_DELIMITER;
+        }
+    }
 
-    return NULL;
+    memcpy(p, data, data_len);
+    p[data_len] = 0;
+    if (data_offset)
+        *data_offset = p - buf;
+    p += data_len + 1;
+
+    if (trailer) {
+        uint16_t crc = crc16(buf, p - buf);
+        if (framing == SRRP_FRAMING_BINARY)
+            srrp_put_le16(p, crc);
+        else
+            snprintf(p, SRRP_CRC16_TRAILER_LEN + 1, "%.4x", crc);
+    }
+    return len;
 }
 
-struct srrp_packet *
-srrp_write_request(uint16_t srcid, const char *header, const char *data)
+static struct srrp_packet *
+srrp_new_packet(int framing, char leader, char seat, uint16_t seqno, uint16_t srcid,
+                uint16_t reqcrc16, const char *header, size_t header_len,
+                const char *data, size_t data_len)
 {
-    int len = 15 + strlen(header) + 1 + strlen(data) + 1/*stop*/;
-    assert(len < SRRP_LENGTH_MAX - 4/*crc16*/);
+    char raw[SRRP_LENGTH_MAX];
+    size_t data_offset;
+    int len = srrp_encode(raw, sizeof(raw), framing, leader, seat,
+                          seqno, srcid, reqcrc16, header, header_len,
+                          data, data_len, &data_offset);
+    if (len == -1)
+        return NULL;
 
     struct srrp_packet *pac = calloc(1, sizeof(*pac) + len);
     assert(pac);
-
-    int nr = snprintf(pac->raw, len, ">0,$,%.4x,%.4x:%s?%s",
-                      (uint32_t)len, srcid, header, data);
-    assert(nr + 1 == len);
-
-    pac->leader = SRRP_REQUEST_LEADER;
-    pac->seat = '$';
-    pac->seqno = 0;
+    memcpy(pac->raw, raw, len);
+    pac->leader = leader;
+    pac->seat = seat;
+    pac->seqno = seqno;
     pac->len = len;
     pac->srcid = srcid;
-    snprintf((char *)pac->header, sizeof(pac->header), "%s", header);
-    pac->header_len = strlen(header);
-    pac->data_len = strlen(data);
-    pac->data = pac->raw + len - pac->data_len - 1;
+    pac->reqcrc16 = reqcrc16;
+    if (header)
+        memcpy((void *)pac->header, header, header_len);
+    pac->header_len = header_len;
+    pac->data = pac->raw + data_offset;
+    pac->data_len = data_len;
     return pac;
 }
 
-struct srrp_packet *
-srrp_write_response(uint16_t srcid, uint16_t reqcrc16, const char *header, const char *data)
+static struct srrp_packet *
+srrp_write_text(char leader, uint16_t seqno, uint16_t srcid, uint16_t reqcrc16,
+                const char *header, const char *data)
 {
-    int len = 15 + 5/*crc16*/ + strlen(header) + 1 + strlen(data) + 1/*stop*/;
-    assert(len < SRRP_LENGTH_MAX - 4/*crc16*/);
+    size_t header_len = strlen(header);
+    assert(header_len < SRRP_HEADER_LEN);
 
-    struct srrp_packet *pac = calloc(1, sizeof(*pac) + len);
+    struct srrp_packet *pac = srrp_new_packet(
+        SRRP_FRAMING_TEXT, leader, SRRP_END_PACKET, seqno, srcid, reqcrc16,
+        header, header_len, data, strlen(data));
     assert(pac);
-
-    int nr = snprintf(pac->raw, len, "<0,$,%.4x,%.4x,%.4x:%s?%s",
-                      (uint32_t)len, srcid, reqcrc16, header, data);
-    assert(nr + 1 == len);
-
-    pac->leader = SRRP_RESPONSE_LEADER;
-    pac->seat = '$';
-    pac->seqno = 0;
-    pac->len = len;
-    pac->srcid = srcid;
-    pac->reqcrc16 = reqcrc16;
-    snprintf((char *)pac->header, sizeof(pac->header), "%s", header);
-    pac->header_len = strlen(header);
-    pac->data_len = strlen(data);
-    pac->data = pac->raw + len - pac->data_len - 1;
     return pac;
 }
 
 struct srrp_packet *
-srrp_write_subscribe(const char *header, const char *ctrl)
+srrp_write_request(uint16_t srcid, const char *header, const char *data)
 {
-    int len = 10 + strlen(header) + 1 + strlen(ctrl) + 1/*stop*/;
-    assert(len < SRRP_LENGTH_MAX - 4/*crc16*/);
-
-    struct srrp_packet *pac = calloc(1, sizeof(*pac) + len);
-    assert(pac);
+    return srrp_write_text(SRRP_REQUEST_LEADER, 0, srcid, 0, header, data);
+}
 
-    int nr = snprintf(pac->raw, len, "#0,$,%.4x:%s?%s", (uint32_t)len, header, ctrl);
-    assert(nr + 1 == len);
+struct srrp_packet *
+srrp_write_response(uint16_t srcid, uint16_t reqcrc16, const char *header, const char *data)
+{
+    return srrp_write_text(SRRP_RESPONSE_LEADER, 0, srcid, reqcrc16, header, data);
+}
 
-    pac->leader = SRRP_SUBSCRIBE_LEADER;
-    pac->seat = '$';
-    pac->seqno = 0;
-    pac->len = len;
-    snprintf((char *)pac->header, sizeof(pac->header), "%s", header);
-    pac->header_len = strlen(header);
-    pac->data_len = strlen(ctrl);
-    pac->data = pac->raw + len - pac->data_len - 1;
-    return pac;
+struct srrp_packet *
+srrp_write_subscribe(const char *header, const char *ctrl)
+{
+    return srrp_write_text(SRRP_SUBSCRIBE_LEADER, 0, 0, 0, header, ctrl);
 }
 
 struct srrp_packet *
 srrp_write_unsubscribe(const char *header)
 {
-    int len = 10 + strlen(header) + 1 + 2/*data*/ + 1/*stop*/;
-    assert(len < SRRP_LENGTH_MAX - 4/*crc16*/);
+    return srrp_write_text(SRRP_UNSUBSCRIBE_LEADER, 0, 0, 0, header, "{}");
+}
 
-    struct srrp_packet *pac = calloc(1, sizeof(*pac) + len);
+struct srrp_packet *
+srrp_write_publish(const char *header, const char *data)
+{
+    struct srrp_packet *pac = srrp_write_publish_seqno(0, header, data);
     assert(pac);
-
-    int nr = snprintf(pac->raw, len, "%%0,$,%.4x:%s?{}", (uint32_t)len, header);
-    assert(nr + 1 == len);
-
-    pac->leader = SRRP_UNSUBSCRIBE_LEADER;
-    pac->seat = '$';
-    pac->seqno = 0;
-    pac->len = len;
-    snprintf((char *)pac->header, sizeof(pac->header), "%s", header);
-    pac->header_len = strlen(header);
-    pac->data_len = 2;
-    pac->data = pac->raw + len - pac->data_len - 1;
     return pac;
 }
 
 struct srrp_packet *
-srrp_write_publish(const char *header, const char *data)
+srrp_write_publish_seqno(uint16_t seqno, const char *header, const char *data)
 {
-    int len = 10 + strlen(header) + 1 + strlen(data) + 1/*stop*/;
-    assert(len < SRRP_LENGTH_MAX - 4/*crc16*/);
-
-    struct srrp_packet *pac = calloc(1, sizeof(*pac) + len);
-    assert(pac);
+    size_t header_len = strlen(header);
+    if (header_len >= SRRP_HEADER_LEN)
+        return NULL;
+    return srrp_new_packet(
+        SRRP_FRAMING_TEXT, SRRP_PUBLISH_LEADER, SRRP_END_PACKET, seqno, 0, 0,
+        header, header_len, data, strlen(data));
+}
 
-    int nr = snprintf(pac->raw, len, "@0,$,%.4x:%s?%s", (uint32_t)len, header, data);
-    assert(nr + 1 == len);
+struct srrp_packet *
+srrp_write_ack(uint16_t seqno, const char *header)
+{
+    return srrp_write_text(SRRP_ACK_LEADER, seqno, 0, 0, header, "{}");
+}
 
-    pac->leader = SRRP_PUBLISH_LEADER;
-    pac->seat = '$';
-    pac->seqno = 0;
-    pac->len = len;
-    snprintf((char *)pac->header, sizeof(pac->header), "%s", header);
-    pac->header_len = strlen(header);
-    pac->data_len = strlen(data);
-    pac->data = pac->raw + len - pac->data_len - 1;
-    return pac;
+int srrp_write_view(char *buf, size_t size, const struct srrp_view *view,
+                    int framing)
+{
+    return srrp_encode(buf, size, framing, view->leader, view->seat,
+                       view->seqno, view->srcid, view->reqcrc16, view->header,
+                       view->header_len, view->data, view->data_len, NULL);
 }
 
-int srrp_next_packet_offset(const char *buf)
+struct srrp_packet *
+srrp_convert(const struct srrp_packet *pac, int framing)
 {
-    if (isdigit(buf[1])) {
-        if (buf[0] == SRRP_REQUEST_LEADER ||
-            buf[0] == SRRP_RESPONSE_LEADER ||
-            buf[0] == SRRP_SUBSCRIBE_LEADER ||
-            buf[0] == SRRP_UNSUBSCRIBE_LEADER ||
-            buf[0] == SRRP_PUBLISH_LEADER) {
-            return 0;
-        }
-    }
+    return srrp_new_packet(framing, pac->leader, pac->seat, pac->seqno,
+                           pac->srcid, pac->reqcrc16,
+                           pac->header_len ? pac->header : NULL,
+                           pac->header_len, pac->data, pac->data_len);
+}
 
-    char *p = NULL;
+int srrp_write_stream(char leader, uint16_t srcid, uint16_t reqcrc16,
+                      const char *header, const char *data,
+                      srrp_emit_fn emit, void *arg)
+{
+    return srrp_write_stream_framing(SRRP_FRAMING_TEXT, leader, srcid,
+                                     reqcrc16, header, data, emit, arg);
+}
 
-    p = strchr(buf, SRRP_REQUEST_LEADER);
-    if (p && p[-1] != SRRP_REQUEST_LEADER && isdigit(p[1]))
-        return p - buf;
+int srrp_write_stream_framing(int framing, char leader, uint16_t srcid,
+                              uint16_t reqcrc16, const char *header,
+                              const char *data, srrp_emit_fn emit, void *arg)
+{
+    char raw[SRRP_LENGTH_MAX];
+    char slice[SRRP_LENGTH_MAX];
+    size_t header_len = strlen(header);
+    size_t data_len = strlen(data);
+    size_t body_len = header_len + 1 + data_len;
+    size_t offset = 0;
+    uint16_t seqno = 0;
+
+    assert(header_len < SRRP_HEADER_LEN);
+
+    do {
+        // sized by the longer prefix of both framings
+        size_t prefix = srrp_write_prefix(
+            raw, sizeof(raw), leader, SRRP_END_PACKET, seqno, 0, srcid, reqcrc16);
+        if (prefix < SRRP_BINARY_HEADER_SIZE)
+            prefix = SRRP_BINARY_HEADER_SIZE;
+        size_t room = SRRP_LENGTH_MAX - SRRP_CRC16_TRAILER_LEN - 1 - prefix - 1/*stop*/;
+        size_t chunk = body_len - offset < room ? body_len - offset : room;
+        int len;
+
+        if (offset == 0 && chunk == body_len) {
+            len = srrp_encode(raw, sizeof(raw), framing, leader,
+                              SRRP_END_PACKET, 0, srcid, reqcrc16,
+                              header, header_len, data, data_len, NULL);
+        } else {
+            char seat;
+            if (offset + chunk == body_len)
+                seat = SRRP_END_PACKET;
+            else if (offset == 0)
+                seat = SRRP_BEGIN_PACKET;
+            else
+                seat = SRRP_MID_PACKET;
+
+            // the body is header, '?' and data
+            char *p = slice;
+            for (size_t i = offset; i < offset + chunk;) {
+                size_t n;
+                if (i < header_len) {
+                    n = header_len - i < offset + chunk - i ?
+                        header_len - i : offset + chunk - i;
+                    memcpy(p, header + i, n);
+                } else if (i == header_len) {
+                    n = 1;
+                    *p = SRRP_DATA_DELIMITER;
+                } else {
+                    n = offset + chunk - i;
+                    memcpy(p, data + i - header_len - 1, n);
+                }
+                p += n;
+                i += n;
+            }
+
+            len = srrp_encode(raw, sizeof(raw), framing, leader, seat, seqno,
+                              srcid, reqcrc16, NULL, 0, slice, chunk, NULL);
+        }
+        assert(len > 0);
 
-    p = strchr(buf, SRRP_RESPONSE_LEADER);
-    if (p && p[-1] != SRRP_RESPONSE_LEADER && isdigit(p[1]))
-        return p - buf;
+        if (emit(raw, len, arg) != 0)
+            return -1;
 
-    p = strchr(buf, SRRP_SUBSCRIBE_LEADER);
-    if (p && p[-1] != SRRP_SUBSCRIBE_LEADER && isdigit(p[1]))
-        return p - buf;
+        offset += chunk;
+        seqno++;
+    } while (offset < body_len);
 
-    p = strchr(buf, SRRP_UNSUBSCRIBE_LEADER);
-    if (p && p[-1] != SRRP_UNSUBSCRIBE_LEADER && isdigit(p[1]))
-        return p - buf;
+    return 0;
+}
 
-    p = strchr(buf, SRRP_PUBLISH_LEADER);
-    if (p && p[-1] != SRRP_PUBLISH_LEADER && isdigit(p[1]))
-        return p - buf;
+int srrp_next_packet_offset(const char *buf)
+{
+    // the null terminator is scanned too, a leader must have a digit after it
+    size_t len = strlen(buf) + 1;
+    if (srrp_is_leader(buf[0]) && isdigit((unsigned char)buf[1]))
+        return 0;
 
-    return -1;
+    size_t offset = srrp_next_leader(buf, len);
+    return offset == len ? -1 : (int)offset;
 }
@@ -1,6 +1,7 @@
 #ifndef __SRRP_H // simple request response protocol
 #define __SRRP_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -29,6 +30,21 @@ extern "C" {
  *
  * Publish: @[0xseqno],[^|0|$],[0xlenth]:[topic]?{data}\0<crc16>\0
  *   @0,$,0043:/motor/speed?{speed:12,voltage:24}\0<crc16>\0
+ *
+ * Ack: ![0xseqno],[^|0|$],[0xlenth]:[topic]?{}\0<crc16>\0
+ *   !1a,$,0024:/motor/speed?{}\0<crc16>\0
+ * sent back by a subscriber with ack:1 for each publish, with its seqno
+ *
+ * Binary: 0xb5,[leader],[seat],[flags],[seqno],[len],[srcid],[reqcrc16],
+ *         [header_len],[data_len],[header][data]\0<crc16>
+ *   fields after the leading 4 bytes are little endian uint16, the same
+ *   packet as the text one without hex fields or the '?' delimiter. A
+ *   fragment has header_len 0 and its slice of header?data in data.
+ *
+ * <crc16> is optional and counted in len, 4 hex digits and a null in text,
+ * a little endian uint16 with SRRP_BINARY_FLAG_CRC16 set in binary. It is
+ * the crc16 of the packet up to the stop null, written when enabled by
+ * srrp_set_crc16 or SRRP_FRAMING_CRC16 and verified whenever present.
  */
 
 #define SRRP_REQUEST_LEADER '>'
@@ -36,6 +52,7 @@ extern "C" {
 #define SRRP_SUBSCRIBE_LEADER '#'
 #define SRRP_UNSUBSCRIBE_LEADER '%'
 #define SRRP_PUBLISH_LEADER '@'
+#define SRRP_ACK_LEADER '!'
 
 #define SRRP_BEGIN_PACKET '^'
 #define SRRP_MID_PACKET '0'
@@ -43,6 +60,15 @@ extern "C" {
 #define SRRP_HEADER_DELIMITER ':'
 #define SRRP_DATA_DELIMITER '?'
 
+#define SRRP_BINARY_MARKER ((char)0xb5)
+#define SRRP_BINARY_HEADER_SIZE 16
+#define SRRP_BINARY_FLAG_CRC16 0x01
+#define SRRP_CRC16_TRAILER_LEN 5
+
+#define SRRP_FRAMING_TEXT 0
+#define SRRP_FRAMING_BINARY 1
+#define SRRP_FRAMING_CRC16 0x100 // or'ed into the framing of a writer, append the trailer
+
 #define SRRP_HEADER_LEN 128
 #define SRRP_SEQNO_HIGH 966
 #define SRRP_LENGTH_MAX 4096
@@ -62,10 +88,67 @@ struct srrp_packet {
     char raw[0]; // alloc length = sizeof(struct srrp_packet) + strlen(raw)
 };
 
+/*
+ * A parsed packet borrowing raw, header and data from the buffer it was
+ * parsed from, the buffer must stay untouched while the view is in use.
+ * header is not null terminated, data is. A fragment has no header, its
+ * slice of header?data is in data. raw is either framing, see
+ * srrp_view_framing.
+ */
+struct srrp_view {
+    char leader;
+    char seat;
+    uint16_t seqno;
+    uint16_t len;
+    uint16_t srcid;
+    uint16_t reqcrc16;
+    const char *header;
+    uint32_t header_len;
+    const char *data;
+    uint32_t data_len;
+    const char *raw;
+};
+
 void srrp_free(struct srrp_packet *pac);
 
+/*
+ * Append the crc16 trailer to the packets written from now on or not,
+ * off by default, return the previous setting. The setting is process
+ * wide and applies to every thread, for single writers or peers pass
+ * SRRP_FRAMING_CRC16 with the framing instead.
+ */
+int srrp_set_crc16(int enable);
+
+static inline int srrp_view_framing(const struct srrp_view *view)
+{
+    return view->raw && view->raw[0] == SRRP_BINARY_MARKER ?
+        SRRP_FRAMING_BINARY : SRRP_FRAMING_TEXT;
+}
+
+/*
+ * Same as srrp_parse but fills view without allocating or copying,
+ * return 0 on success, -1 on failure.
+ */
+int srrp_parse_view(struct srrp_view *view, const char *buf, size_t len,
+                    size_t *consumed);
+
+/*
+ * Split body, a header?data of len bytes followed by a null, into
+ * view->header and view->data, return 0 on success, -1 on failure.
+ */
+int srrp_parse_body(struct srrp_view *view, const char *body, size_t len);
+
 // the retval imply that the caller should free it
 
+/*
+ * Parse one packet from buf without reading beyond len.
+ * On success *consumed is the packet length. On failure NULL is returned,
+ * *consumed == 0 means buf holds an incomplete packet, otherwise the first
+ * *consumed bytes can't begin a packet and should be skipped.
+ */
+struct srrp_packet *
+srrp_parse(const char *buf, size_t len, size_t *consumed);
+
 struct srrp_packet *
 srrp_read_one_packet(const char *buf);
 
@@ -84,6 +167,46 @@ srrp_write_unsubscribe(const char *header);
 struct srrp_packet *
 srrp_write_publish(const char *header, const char *data);
 
+// NULL if too large, a seqno above 0xf takes more than srrp_write_publish
+struct srrp_packet *
+srrp_write_publish_seqno(uint16_t seqno, const char *header, const char *data);
+
+struct srrp_packet *
+srrp_write_ack(uint16_t seqno, const char *header);
+
+/*
+ * Encode view as a single packet of framing into buf, return its length,
+ * or -1 if it does not fit in size or SRRP_LENGTH_MAX.
+ */
+int srrp_write_view(char *buf, size_t size, const struct srrp_view *view,
+                    int framing);
+
+/*
+ * Same packet as pac encoded in framing, NULL if it does not fit.
+ */
+struct srrp_packet *
+srrp_convert(const struct srrp_packet *pac, int framing);
+
+/*
+ * Write header?data of any length as a stream of packets no longer than
+ * SRRP_LENGTH_MAX: a single '$' packet if it fits, otherwise fragments
+ * seated '^', '0'..., '$' with seqnos counting from 0. Each packet is
+ * passed to emit as soon as it is built, emit returns 0 to go on.
+ */
+typedef int (*srrp_emit_fn)(const char *raw, size_t len, void *arg);
+
+int srrp_write_stream(char leader, uint16_t srcid, uint16_t reqcrc16,
+                      const char *header, const char *data,
+                      srrp_emit_fn emit, void *arg);
+
+/*
+ * Same as srrp_write_stream in framing, fragments are cut so that each
+ * one still fits in a single packet of the other framing.
+ */
+int srrp_write_stream_framing(int framing, char leader, uint16_t srcid,
+                              uint16_t reqcrc16, const char *header,
+                              const char *data, srrp_emit_fn emit, void *arg);
+
 int srrp_next_packet_offset(const char *buf);
 
 #ifdef __cplusplus
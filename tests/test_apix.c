@@ -6,19 +6,23 @@
 #include <string.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include "apix.h"
 #include "apix-posix.h"
+#include "apix-private.h"
 #include "srrp.h"
 #include "crc16.h"
 #include "log.h"
 
 #define UNIX_ADDR "test_apisink_unix"
 #define TCP_ADDR "127.0.0.1:1224"
+#define UDP_ADDR "127.0.0.1:1226"
 
 static int client_finished = 0;
 static int server_finished = 0;
@@ -234,7 +238,953 @@ static void test_api_subscribe_publish(void **status)
     pthread_join(publish_pid, NULL);
     pthread_join(subscribe_pid, NULL);
 
+    struct apibus_stats stats;
+    apibus_get_stats(bus, &stats);
+    assert_true(stats.topic_msgs.used == 0);
+    assert_true(stats.topic_msgs.peak >= 1);
+    assert_true(stats.topic_msgs.capacity >= stats.topic_msgs.peak);
+    assert_true(stats.topics.used >= 1);
+
+    apibus_close(bus, fd);
+    apibus_disable_posix(bus);
+    apibus_destroy(bus);
+}
+
+static void test_api_poll_timeout(void **status)
+{
+    struct apibus *bus = apibus_new();
+    apibus_enable_posix(bus);
+    int fd = apibus_open_unix(bus, UNIX_ADDR);
+
+    struct timeval begin, end;
+
+    // idle bus blocks for the whole timeout
+    gettimeofday(&begin, NULL);
+    apibus_poll_timeout(bus, 200);
+    gettimeofday(&end, NULL);
+    long elapsed = (end.tv_sec - begin.tv_sec) * 1000 +
+        (end.tv_usec - begin.tv_usec) / 1000;
+    assert_true(elapsed >= 150 && elapsed < 1000);
+
+    // a new connection wakes it up at once
+    int cfd = socket(PF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {0};
+    addr.sun_family = PF_UNIX;
+    strcpy(addr.sun_path, UNIX_ADDR);
+    assert_true(connect(cfd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+
+    gettimeofday(&begin, NULL);
+    apibus_poll_timeout(bus, 5000);
+    gettimeofday(&end, NULL);
+    elapsed = (end.tv_sec - begin.tv_sec) * 1000 +
+        (end.tv_usec - begin.tv_usec) / 1000;
+    assert_true(elapsed < 1000);
+
+    close(cfd);
+    apibus_close(bus, fd);
+    apibus_disable_posix(bus);
+    apibus_destroy(bus);
+}
+
+static int unix_connect(void)
+{
+    int fd = socket(PF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {0};
+    addr.sun_family = PF_UNIX;
+    strcpy(addr.sun_path, UNIX_ADDR);
+    assert_true(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    return fd;
+}
+
+// the fds the bus accepted, in the order the peers connected
+static int accepted_fds(struct apibus *bus, int listen_fd, int *fds, int size)
+{
+    int all[64];
+    int n = 0, nall = apibus_get_fds(bus, all, 64);
+    for (int i = 0; i < nall && n < size; i++) {
+        if (all[i] != listen_fd)
+            fds[n++] = all[i];
+    }
+    return n;
+}
+
+static int recv_until(struct apibus *bus, int fd, char *buf, size_t size,
+                      size_t len)
+{
+    size_t nrecv = 0;
+    for (int i = 0; i < 100 && nrecv < len; i++) {
+        apibus_poll_timeout(bus, 10);
+        int nr = recv(fd, buf + nrecv, size - nrecv, MSG_DONTWAIT);
+        if (nr > 0)
+            nrecv += nr;
+    }
+    return nrecv;
+}
+
+static void test_api_topic_wildcard(void **status)
+{
+    struct apibus *bus = apibus_new();
+    apibus_enable_posix(bus);
+    int fd = apibus_open_unix(bus, UNIX_ADDR);
+
+    int sub = unix_connect();
+    int pub = unix_connect();
+    char buf[256] = {0};
+
+    // the second "/device/#" is not added again
+    const char *filters[] = {
+        "/device/+/metric", "/device/#", "/+/7/#", "/device/#" };
+    for (size_t i = 0; i < sizeof(filters) / sizeof(filters[0]); i++) {
+        struct srrp_packet *pac = srrp_write_subscribe(filters[i], "{}");
+        assert_true(send(sub, pac->raw, pac->len, 0) == pac->len);
+        srrp_free(pac);
+        assert_true(recv_until(bus, sub, buf, sizeof(buf), 6) == 6);
+        assert_true(memcmp(buf, "Sub OK", 6) == 0);
+    }
+
+    // '#' must be the last segment
+    struct srrp_packet *pac = srrp_write_subscribe("/device/#/metric", "{}");
+    assert_true(send(sub, pac->raw, pac->len, 0) == pac->len);
+    srrp_free(pac);
+    assert_true(recv_until(bus, sub, buf, sizeof(buf), 7) == 7);
+    assert_true(memcmp(buf, "Sub ERR", 7) == 0);
+
+    // not matched at all
+    struct srrp_packet *pac_drop = srrp_write_publish("/other/8", "{}");
+    assert_true(send(pub, pac_drop->raw, pac_drop->len, 0) == pac_drop->len);
+    srrp_free(pac_drop);
+
+    // a trailing '#' matches no segment as well
+    struct srrp_packet *pac_one = srrp_write_publish("/other/7", "{}");
+    assert_true(send(pub, pac_one->raw, pac_one->len, 0) == pac_one->len);
+
+    // matched by all filters, delivered once
+    struct srrp_packet *pac_all = srrp_write_publish("/device/7/metric", "{v:1}");
+    assert_true(send(pub, pac_all->raw, pac_all->len, 0) == pac_all->len);
+
+    memset(buf, 0, sizeof(buf));
+    size_t len = pac_one->len + pac_all->len;
+    assert_true(recv_until(bus, sub, buf, sizeof(buf), len + 1) == len);
+    assert_true(memcmp(buf, pac_one->raw, pac_one->len) == 0);
+    assert_true(memcmp(buf + pac_one->len, pac_all->raw, pac_all->len) == 0);
+    srrp_free(pac_one);
+    srrp_free(pac_all);
+
+    struct apibus_stats stats;
+    apibus_get_stats(bus, &stats);
+    assert_true(stats.subscribers.used == 3);
+
+    // subscriptions and the topics left empty go away with the fd
+    close(sub);
+    recv_until(bus, pub, buf, sizeof(buf), 1);
+    apibus_get_stats(bus, &stats);
+    assert_true(stats.subscribers.used == 0);
+    assert_true(stats.topics.used == 1);
+
+    close(pub);
+    apibus_close(bus, fd);
+    apibus_disable_posix(bus);
+    apibus_destroy(bus);
+}
+
+static void test_api_topic_fanout(void **status)
+{
+    struct apibus *bus = apibus_new();
+    apibus_enable_posix(bus);
+    int fd = apibus_open_unix(bus, UNIX_ADDR);
+
+    int subs[100];
+    char buf[256] = {0};
+    struct srrp_packet *pac = srrp_write_subscribe("/fanout", "{}");
+    for (int i = 0; i < 100; i++) {
+        subs[i] = unix_connect();
+        assert_true(send(subs[i], pac->raw, pac->len, 0) == pac->len);
+    }
+    srrp_free(pac);
+    for (int i = 0; i < 100; i++) {
+        assert_true(recv_until(bus, subs[i], buf, sizeof(buf), 6) == 6);
+        assert_true(memcmp(buf, "Sub OK", 6) == 0);
+    }
+
+    int pub = unix_connect();
+    pac = srrp_write_publish("/fanout", "{}");
+    assert_true(send(pub, pac->raw, pac->len, 0) == pac->len);
+    for (int i = 0; i < 100; i++) {
+        assert_true(recv_until(bus, subs[i], buf, sizeof(buf), pac->len) == pac->len);
+        assert_true(memcmp(buf, pac->raw, pac->len) == 0);
+    }
+    srrp_free(pac);
+
+    for (int i = 0; i < 100; i++)
+        close(subs[i]);
+    close(pub);
+    apibus_close(bus, fd);
+    apibus_disable_posix(bus);
+    apibus_destroy(bus);
+}
+
+static void test_api_topic_cache(void **status)
+{
+    struct apibus *bus = apibus_new();
+    apibus_enable_posix(bus);
+    int fd = apibus_open_unix(bus, UNIX_ADDR);
+
+    char buf[256] = {0};
+    int sub = unix_connect();
+    struct srrp_packet *pac = srrp_write_subscribe("/telemetry", "{ack:0,cache:2}");
+    assert_true(send(sub, pac->raw, pac->len, 0) == pac->len);
+    srrp_free(pac);
+    assert_true(recv_until(bus, sub, buf, sizeof(buf), 6) == 6);
+    close(sub);
+
+    // published while the subscriber is offline, the last 2 are kept
+    int pub = unix_connect();
+    struct srrp_packet *pacs[3];
+    pacs[0] = srrp_write_publish("/telemetry", "{v:0}");
+    pacs[1] = srrp_write_publish("/telemetry", "{v:1}");
+    pacs[2] = srrp_write_publish("/telemetry", "{v:2}");
+    for (int i = 0; i < 3; i++)
+        assert_true(send(pub, pacs[i]->raw, pacs[i]->len, 0) == pacs[i]->len);
+    recv_until(bus, pub, buf, sizeof(buf), 1);
+
+    // and replayed once it comes back
+    sub = unix_connect();
+    pac = srrp_write_subscribe("/telemetry", "{}");
+    assert_true(send(sub, pac->raw, pac->len, 0) == pac->len);
+    srrp_free(pac);
+    size_t len = 6 + pacs[1]->len + pacs[2]->len;
+    memset(buf, 0, sizeof(buf));
+    assert_true(recv_until(bus, sub, buf, sizeof(buf), len + 1) == len);
+    assert_true(memcmp(buf, "Sub OK", 6) == 0);
+    assert_true(memcmp(buf + 6, pacs[1]->raw, pacs[1]->len) == 0);
+    assert_true(memcmp(buf + 6 + pacs[1]->len, pacs[2]->raw, pacs[2]->len) == 0);
+    for (int i = 0; i < 3; i++)
+        srrp_free(pacs[i]);
+
+    // subscribing again only changes the ctrl, nothing is replayed twice
+    pac = srrp_write_subscribe("/telemetry", "{ack:1}");
+    assert_true(send(sub, pac->raw, pac->len, 0) == pac->len);
+    srrp_free(pac);
+    memset(buf, 0, sizeof(buf));
+    assert_true(recv_until(bus, sub, buf, sizeof(buf), 7) == 6);
+    assert_true(memcmp(buf, "Sub OK", 6) == 0);
+
+    // an explicit unsubscribe drops the cache with the topic
+    pac = srrp_write_unsubscribe("/telemetry");
+    assert_true(send(sub, pac->raw, pac->len, 0) == pac->len);
+    srrp_free(pac);
+    assert_true(recv_until(bus, sub, buf, sizeof(buf), 8) == 8);
+    struct apibus_stats stats;
+    apibus_get_stats(bus, &stats);
+    assert_true(stats.topics.used == 1);
+
+    close(sub);
+    close(pub);
+    apibus_close(bus, fd);
+    apibus_disable_posix(bus);
+    apibus_destroy(bus);
+}
+
+// parse the publishes in buf, return the number of them
+static int parse_seqnos(const char *buf, size_t len, uint16_t *seqnos)
+{
+    int nr = 0;
+    size_t offset = 0;
+    while (offset < len) {
+        size_t consumed = 0;
+        struct srrp_packet *pac = srrp_parse(buf + offset, len - offset, &consumed);
+        assert_true(pac);
+        assert_true(pac->leader == '@');
+        seqnos[nr++] = pac->seqno;
+        srrp_free(pac);
+        offset += consumed;
+    }
+    return nr;
+}
+
+static void test_api_topic_ack(void **status)
+{
+    struct apibus *bus = apibus_new();
+    apibus_enable_posix(bus);
+    int fd = apibus_open_unix(bus, UNIX_ADDR);
+
+    char buf[4096] = {0};
+    int sub = unix_connect();
+    struct srrp_packet *pac = srrp_write_subscribe("/actuator", "{ack:1}");
+    assert_true(send(sub, pac->raw, pac->len, 0) == pac->len);
+    srrp_free(pac);
+    assert_true(recv_until(bus, sub, buf, sizeof(buf), 6) == 6);
+
+    // 20 publishes, the window lets 16 of them out
+    int pub = unix_connect();
+    pac = srrp_write_publish("/actuator", "{on:1}");
+    for (int i = 0; i < 20; i++)
+        assert_true(send(pub, pac->raw, pac->len, 0) == pac->len);
+    srrp_free(pac);
+
+    uint16_t seqnos[64];
+    pac = srrp_write_publish_seqno(0, "/actuator", "{on:1}");
+    size_t len = recv_until(bus, sub, buf, sizeof(buf), 16 * pac->len);
+    srrp_free(pac);
+    assert_true(parse_seqnos(buf, len, seqnos) == 16);
+    for (int i = 0; i < 16; i++)
+        assert_true(seqnos[i] == i);
+
+    struct apibus_stats stats;
+    apibus_get_stats(bus, &stats);
+    assert_true(stats.ack_stalls == 4);
+    assert_true(stats.ack_redeliveries == 0);
+
+    // not acked, so they are sent again after API_ACK_TIMEOUT
+    for (int i = 0; i < 300 && stats.ack_redeliveries < 16; i++) {
+        apibus_poll_timeout(bus, 10);
+        apibus_get_stats(bus, &stats);
+    }
+    assert_true(stats.ack_redeliveries == 16);
+    memset(buf, 0, sizeof(buf));
+    len = recv_until(bus, sub, buf, sizeof(buf), len);
+    assert_true(parse_seqnos(buf, len, seqnos) == 16);
+    for (int i = 0; i < 16; i++)
+        assert_true(seqnos[i] == i);
+
+    // acks slide the window over the other 4
+    for (int i = 0; i < 16; i++) {
+        pac = srrp_write_ack(i, "/actuator");
+        assert_true(send(sub, pac->raw, pac->len, 0) == pac->len);
+        srrp_free(pac);
+    }
+    memset(buf, 0, sizeof(buf));
+    pac = srrp_write_publish_seqno(0x10, "/actuator", "{on:1}");
+    len = recv_until(bus, sub, buf, sizeof(buf), 4 * pac->len);
+    srrp_free(pac);
+    assert_true(parse_seqnos(buf, len, seqnos) == 4);
+    for (int i = 0; i < 4; i++)
+        assert_true(seqnos[i] == 16 + i);
+
+    for (int i = 16; i < 20; i++) {
+        pac = srrp_write_ack(i, "/actuator");
+        assert_true(send(sub, pac->raw, pac->len, 0) == pac->len);
+        srrp_free(pac);
+    }
+    apibus_poll_timeout(bus, 10);
+
+    // a full sized publish has no room for seqno 0x14, it is sent untracked
+    char *data = malloc(SRRP_LENGTH_MAX);
+    memset(data, 'x', SRRP_LENGTH_MAX);
+    data[0] = '{';
+    pac = NULL;
+    // the len field widens with the packet, shrink the data until it fits
+    for (size_t data_len = SRRP_LENGTH_MAX - 1; pac == NULL; data_len--) {
+        data[data_len - 1] = '}';
+        data[data_len] = 0;
+        pac = srrp_write_publish_seqno(0, "/actuator", data);
+        data[data_len - 1] = 'x';
+    }
+    assert_true(pac->len == SRRP_LENGTH_MAX);
+    free(data);
+
+    assert_true(send(pub, pac->raw, pac->len, 0) == pac->len);
+    char *big = malloc(2 * SRRP_LENGTH_MAX);
+    len = recv_until(bus, sub, big, 2 * SRRP_LENGTH_MAX, pac->len + 1);
+    assert_true(len == pac->len);
+    assert_true(memcmp(big, pac->raw, pac->len) == 0);
+    free(big);
+    srrp_free(pac);
+    apibus_get_stats(bus, &stats);
+    assert_true(stats.ack_drops == 1);
+
+    close(sub);
+    close(pub);
+    apibus_close(bus, fd);
+    apibus_disable_posix(bus);
+    apibus_destroy(bus);
+}
+
+static void test_api_send_queue(void **status)
+{
+    struct apibus *bus = apibus_new();
+    apibus_enable_posix(bus);
+    int fd = apibus_open_unix(bus, UNIX_ADDR);
+
+    int cfd = socket(PF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {0};
+    addr.sun_family = PF_UNIX;
+    strcpy(addr.sun_path, UNIX_ADDR);
+    assert_true(connect(cfd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    apibus_poll_timeout(bus, 100);
+
+    int sfd;
+    assert_true(accepted_fds(bus, fd, &sfd, 1) == 1);
+    assert_true(apibus_ioctl(bus, sfd, APIBUS_IOCTL_TX_HWM, 4096) == 0);
+
+    // packets sent within one poll go out with one write
+    struct apibus_stats stats;
+    apibus_get_stats(bus, &stats);
+    uint64_t packets = stats.tx_packets;
+    uint64_t syscalls = stats.tx_syscalls;
+    for (int i = 0; i < 10; i++)
+        assert_true(apibus_send(bus, sfd, "0123456789", 10) == 10);
+    apibus_poll_timeout(bus, 0);
+    apibus_get_stats(bus, &stats);
+    assert_true(stats.tx_packets - packets == 10);
+    assert_true(stats.tx_syscalls - syscalls == 1);
+
+    char buf[1024];
+    assert_true(recv(cfd, buf, sizeof(buf), 0) == 100);
+
+    // the client does not read, so the kernel fills up, then the txbuf
+    size_t sent = 0;
+    int i, rc = 0;
+    for (i = 0; i < 10000; i++) {
+        memset(buf, i & 0xff, sizeof(buf));
+        rc = apibus_send(bus, sfd, buf, sizeof(buf));
+        if (rc == -1)
+            break;
+        assert_true(rc == sizeof(buf));
+        sent += rc;
+    }
+    assert_true(rc == -1);
+
+    apibus_get_stats(bus, &stats);
+    assert_true(stats.tx_drops == 1);
+
+    // everything accepted arrives intact once the client reads
+    size_t recvd = 0;
+    while (recvd < sent) {
+        int nr = recv(cfd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (nr > 0) {
+            for (int j = 0; j < nr; j++)
+                assert_true((unsigned char)buf[j] == ((recvd + j) / 1024 & 0xff));
+            recvd += nr;
+        } else {
+            apibus_poll_timeout(bus, 10);
+        }
+    }
+    assert_true(recvd == sent);
+
+    close(cfd);
+    apibus_close(bus, fd);
+    apibus_disable_posix(bus);
+    apibus_destroy(bus);
+}
+
+static int send_emit(const char *raw, size_t len, void *arg)
+{
+    return send(*(int *)arg, raw, len, 0) == (ssize_t)len ? 0 : -1;
+}
+
+static void test_api_topic_stream(void **status)
+{
+    struct apibus *bus = apibus_new();
+    apibus_enable_posix(bus);
+    int fd = apibus_open_unix(bus, UNIX_ADDR);
+
+    char buf[256] = {0};
+    int sub = unix_connect();
+    struct srrp_packet *pac = srrp_write_subscribe("/camera/frame", "{}");
+    assert_true(send(sub, pac->raw, pac->len, 0) == pac->len);
+    srrp_free(pac);
+    assert_true(recv_until(bus, sub, buf, sizeof(buf), 6) == 6);
+
+    size_t data_len = 32 * 1024;
+    char *data = malloc(data_len + 1);
+    memset(data, 'x', data_len);
+    data[0] = '{';
+    data[data_len - 1] = '}';
+    data[data_len] = 0;
+
+    // published as fragments, reassembled by the broker
+    int pub = unix_connect();
+    assert_true(srrp_write_stream(SRRP_PUBLISH_LEADER, 0, 0, "/camera/frame",
+                                  data, send_emit, &pub) == 0);
+
+    // the subscriber gets the whole message back as fragments
+    size_t size = data_len * 2;
+    char *rx = malloc(size);
+    char *body = malloc(size);
+    size_t rx_len = 0, offset = 0, body_len = 0;
+    int done = 0;
+    for (int i = 0; i < 100 && !done; i++) {
+        apibus_poll_timeout(bus, 10);
+        int nr = recv(sub, rx + rx_len, size - rx_len, MSG_DONTWAIT);
+        if (nr > 0)
+            rx_len += nr;
+        struct srrp_view view;
+        size_t consumed = 0;
+        while (!done && srrp_parse_view(
+                   &view, rx + offset, rx_len - offset, &consumed) == 0) {
+            const char *p = view.header ? view.header : view.data;
+            size_t n = view.data + view.data_len - p;
+            memcpy(body + body_len, p, n);
+            body_len += n;
+            offset += consumed;
+            done = view.seat == SRRP_END_PACKET;
+        }
+    }
+    assert_true(done);
+    assert_true(offset > data_len);
+
+    struct srrp_view view = {0};
+    assert_true(srrp_parse_body(&view, body, body_len) == 0);
+    assert_true(view.header_len == strlen("/camera/frame"));
+    assert_true(view.data_len == data_len);
+    assert_true(memcmp(view.data, data, data_len) == 0);
+
+    // a lone fragment is dropped, nothing is delivered
+    pac = srrp_write_publish("/camera/frame", "{}");
+    char *mid = strdup(pac->raw);
+    mid[strchr(mid, ',') - mid + 1] = '0';
+    send(pub, mid, pac->len, 0);
+    assert_true(recv_until(bus, sub, buf, sizeof(buf), 1) == 0);
+    free(mid);
+    srrp_free(pac);
+
+    free(body);
+    free(rx);
+    free(data);
+    close(sub);
+    close(pub);
+    apibus_close(bus, fd);
+    apibus_disable_posix(bus);
+    apibus_destroy(bus);
+}
+
+static void test_api_binary_framing(void **status)
+{
+    struct apibus *bus = apibus_new();
+    apibus_enable_posix(bus);
+    int fd = apibus_open_unix(bus, UNIX_ADDR);
+
+    char buf[256] = {0};
+    struct srrp_packet *pac = NULL, *bin = NULL;
+
+    // a text subscriber
+    int text_sub = unix_connect();
+    pac = srrp_write_subscribe("/sensor/imu", "{}");
+    assert_true(send(text_sub, pac->raw, pac->len, 0) == pac->len);
+    srrp_free(pac);
+    assert_true(recv_until(bus, text_sub, buf, sizeof(buf), 6) == 6);
+
+    // a binary one, its framing is learnt from what it sends
+    int bin_sub = unix_connect();
+    pac = srrp_write_subscribe("/sensor/imu", "{}");
+    bin = srrp_convert(pac, SRRP_FRAMING_BINARY);
+    assert_true(send(bin_sub, bin->raw, bin->len, 0) == bin->len);
+    srrp_free(bin);
+    srrp_free(pac);
+    assert_true(recv_until(bus, bin_sub, buf, sizeof(buf), 6) == 6);
+
+    // a binary publish reaches both in their own framing
+    int pub = unix_connect();
+    pac = srrp_write_publish("/sensor/imu", "{ax:1,ay:2,az:3}");
+    bin = srrp_convert(pac, SRRP_FRAMING_BINARY);
+    assert_true(send(pub, bin->raw, bin->len, 0) == bin->len);
+
+    memset(buf, 0, sizeof(buf));
+    assert_true(recv_until(bus, text_sub, buf, sizeof(buf), pac->len) == pac->len);
+    assert_true(memcmp(buf, pac->raw, pac->len) == 0);
+    memset(buf, 0, sizeof(buf));
+    assert_true(recv_until(bus, bin_sub, buf, sizeof(buf), bin->len) == bin->len);
+    assert_true(memcmp(buf, bin->raw, bin->len) == 0);
+
+    struct apibus_stats stats;
+    apibus_get_stats(bus, &stats);
+    assert_true(stats.translations == 1);
+
+    // pinned to text, the binary subscriber gets text from now on
+    int accepted[3];
+    assert_true(accepted_fds(bus, fd, accepted, 3) == 3);
+    int bin_fd = accepted[1];
+    assert_true(apibus_ioctl(bus, bin_fd, APIBUS_IOCTL_FRAMING, 3) == -1);
+    assert_true(apibus_ioctl(bus, bin_fd, APIBUS_IOCTL_FRAMING,
+                             APIBUS_FRAMING_TEXT) == 0);
+    assert_true(send(pub, bin->raw, bin->len, 0) == bin->len);
+    memset(buf, 0, sizeof(buf));
+    assert_true(recv_until(bus, bin_sub, buf, sizeof(buf), pac->len) == pac->len);
+    assert_true(memcmp(buf, pac->raw, pac->len) == 0);
+
+    // the trailer is asked for per fd, the other subscriber gets none
+    assert_true(apibus_ioctl(bus, bin_fd, APIBUS_IOCTL_CRC16, 1) == 0);
+    assert_true(send(pub, bin->raw, bin->len, 0) == bin->len);
+    size_t crc_len = pac->len + SRRP_CRC16_TRAILER_LEN;
+    memset(buf, 0, sizeof(buf));
+    assert_true(recv_until(bus, bin_sub, buf, sizeof(buf), crc_len + 1) == crc_len);
+    size_t consumed = 0;
+    struct srrp_packet *crc_pac = srrp_parse(buf, crc_len, &consumed);
+    assert_true(crc_pac && consumed == crc_len);
+    assert_true(strcmp(crc_pac->data, "{ax:1,ay:2,az:3}") == 0);
+    srrp_free(crc_pac);
+    // the last two publishes, both without
+    memset(buf, 0, sizeof(buf));
+    assert_true(recv_until(bus, text_sub, buf, sizeof(buf), 2 * pac->len + 1) ==
+                2 * pac->len);
+    assert_true(memcmp(buf, pac->raw, pac->len) == 0);
+    assert_true(memcmp(buf + pac->len, pac->raw, pac->len) == 0);
+    srrp_free(bin);
+    srrp_free(pac);
+
+    close(text_sub);
+    close(bin_sub);
+    close(pub);
+    apibus_close(bus, fd);
+    apibus_disable_posix(bus);
+    apibus_destroy(bus);
+}
+
+static void test_api_rx_grow(void **status)
+{
+    struct apibus *bus = apibus_new();
+    apibus_enable_posix(bus);
+    int fd = apibus_open_unix(bus, UNIX_ADDR);
+    assert_true(apibus_ioctl(bus, fd, APIBUS_IOCTL_RX_CAP, 1024) == -1);
+    assert_true(apibus_ioctl(bus, fd, APIBUS_IOCTL_RX_CAP, 64 * 1024) == 0);
+
+    int pub = unix_connect();
+    apibus_poll_timeout(bus, 10);
+    int sfd;
+    assert_true(accepted_fds(bus, fd, &sfd, 1) == 1);
+
+    // a burst beyond the initial 4 KB is taken in one poll
+    char data[256];
+    memset(data, 'x', sizeof(data));
+    data[0] = '{';
+    data[sizeof(data) - 2] = '}';
+    data[sizeof(data) - 1] = 0;
+    struct srrp_packet *pac = srrp_write_publish("/burst", data);
+    size_t burst = 64 * pac->len;
+    for (int i = 0; i < 64; i++)
+        assert_true(send(pub, pac->raw, pac->len, 0) == pac->len);
+    srrp_free(pac);
+
+    struct apibus_fd_stats fd_stats;
+    struct apibus_stats stats;
+    apibus_poll_timeout(bus, 10);
+    assert_true(apibus_get_fd_stats(bus, sfd, &fd_stats) == 0);
+    assert_true(fd_stats.rx_used == 0);
+    assert_true(fd_stats.rx_peak == burst);
+    assert_true(fd_stats.rx_size > 4096);
+    assert_true(fd_stats.rx_size <= 64 * 1024);
+    apibus_get_stats(bus, &stats);
+    assert_true(stats.rx_grows >= 1);
+
+    // and given back once idle
+    for (int i = 0; i < 15 && stats.rx_shrinks == 0; i++) {
+        apibus_poll_timeout(bus, 100);
+        apibus_get_stats(bus, &stats);
+    }
+    assert_true(stats.rx_shrinks == 1);
+    assert_true(apibus_get_fd_stats(bus, sfd, &fd_stats) == 0);
+    assert_true(fd_stats.rx_size == 4096);
+    assert_true(fd_stats.rx_peak == burst);
+
+    // the cap is per fd, a listener only hands its own to the fds it accepts
+    int other = unix_connect();
+    apibus_poll_timeout(bus, 10);
+    int fds[2];
+    assert_true(accepted_fds(bus, fd, fds, 2) == 2);
+    assert_true(fds[0] == sfd);
+    assert_true(apibus_ioctl(bus, sfd, APIBUS_IOCTL_RX_CAP, 8 * 1024) == 0);
+    assert_true(apibus_get_fd_stats(bus, sfd, &fd_stats) == 0);
+    assert_true(fd_stats.rx_cap == 8 * 1024);
+    assert_true(apibus_get_fd_stats(bus, fds[1], &fd_stats) == 0);
+    assert_true(fd_stats.rx_cap == 64 * 1024);
+    assert_true(apibus_get_fd_stats(bus, fd, &fd_stats) == 0);
+    assert_true(fd_stats.rx_cap == 64 * 1024);
+
+    close(other);
+    close(pub);
+    apibus_close(bus, fd);
+    apibus_disable_posix(bus);
+    apibus_destroy(bus);
+}
+
+static void test_api_sinkfd_hash(void **status)
+{
+    struct apibus *bus = apibus_new();
+    apibus_enable_posix(bus);
+    int fd = apibus_open_unix(bus, UNIX_ADDR);
+
+    int peer = unix_connect();
+    apibus_poll_timeout(bus, 10);
+    int accepted = -1;
+    assert_true(accepted_fds(bus, fd, &accepted, 1) == 1);
+
+    // fds apart by the hash size share a bucket, each is still found
+    struct sinkfd *listener = find_sinkfd_in_apibus(bus, fd);
+    struct sinkfd *same[2];
+    for (int i = 0; i < 2; i++) {
+        same[i] = sinkfd_new(listener->sink,
+                             accepted + (i + 1) * APIBUS_SINKFD_HASH_SIZE);
+        assert_true(same[i]);
+    }
+    assert_true(find_sinkfd_in_apibus(bus, accepted)->fd == accepted);
+    for (int i = 0; i < 2; i++)
+        assert_true(find_sinkfd_in_apibus(bus, same[i]->fd) == same[i]);
+    assert_true(find_sinkfd_in_apibus(
+                    bus, accepted + 3 * APIBUS_SINKFD_HASH_SIZE) == NULL);
+
+    // and gone once closed, the others of the bucket stay
+    assert_true(apibus_close(bus, accepted) == 0);
+    assert_true(find_sinkfd_in_apibus(bus, accepted) == NULL);
+    assert_true(apibus_send(bus, accepted, "x", 1) == -1);
+    int fd0 = same[0]->fd;
+    sinkfd_destroy(same[0]);
+    assert_true(find_sinkfd_in_apibus(bus, fd0) == NULL);
+    assert_true(find_sinkfd_in_apibus(bus, same[1]->fd) == same[1]);
+    sinkfd_destroy(same[1]);
+    assert_true(find_sinkfd_in_apibus(bus, fd) == listener);
+
+    close(peer);
+    apibus_close(bus, fd);
+    apibus_disable_posix(bus);
+    apibus_destroy(bus);
+}
+
+static int request_and_recv(struct apibus *bus, int fd, uint16_t srcid,
+                            const char *header, char *buf, size_t size)
+{
+    struct srrp_packet *pac = srrp_write_request(srcid, header, "{}");
+    assert_true(send(fd, pac->raw, pac->len, 0) == pac->len);
+    srrp_free(pac);
+    memset(buf, 0, size);
+    return recv_until(bus, fd, buf, size, 1);
+}
+
+static void test_api_station_expire(void **status)
+{
+    struct apibus *bus = apibus_new();
+    apibus_enable_posix(bus);
+    int fd = apibus_open_unix(bus, UNIX_ADDR);
+
+    // stations 1, 2, 3 come online in turn, then 1 is seen again
+    int stt[3];
+    char buf[256];
+    for (int i = 0; i < 3; i++) {
+        char header[32];
+        stt[i] = unix_connect();
+        snprintf(header, sizeof(header), "/%d/online", i + 1);
+        assert_true(request_and_recv(bus, stt[i], i + 1, header, buf, sizeof(buf)) > 0);
+    }
+    assert_true(request_and_recv(bus, stt[0], 1, "/1/online", buf, sizeof(buf)) > 0);
+
+    // the oldest alive is 2, expired alone
+    struct api_station *oldest =
+        list_first_entry(&bus->stations, struct api_station, node);
+    assert_true(oldest->sttid == 2);
+    oldest->ts_alive = time(0) - APIBUS_STATION_ALIVE_TIMEOUT / 1000 - 1;
+    apibus_poll_timeout(bus, 10);
+
+    assert_true(request_and_recv(bus, stt[2], 3, "/2/hello", buf, sizeof(buf)) ==
+                strlen("STATION NOT FOUND"));
+    assert_true(memcmp(buf, "STATION NOT FOUND", 17) == 0);
+    assert_true(request_and_recv(bus, stt[2], 3, "/1/hello", buf, sizeof(buf)) == 0);
+    memset(buf, 0, sizeof(buf));
+    assert_true(recv_until(bus, stt[0], buf, sizeof(buf), 1) > 0);
+    assert_true(strstr(buf, "/1/hello"));
+
+    for (int i = 0; i < 3; i++)
+        close(stt[i]);
+    apibus_close(bus, fd);
+    apibus_disable_posix(bus);
+    apibus_destroy(bus);
+}
+
+static void test_api_request_match(void **status)
+{
+    struct apibus *bus = apibus_new();
+    apibus_enable_posix(bus);
+    int fd = apibus_open_unix(bus, UNIX_ADDR);
+
+    char buf[1024];
+    int stt = unix_connect();
+    assert_true(request_and_recv(bus, stt, 16, "/16/online", buf, sizeof(buf)) > 0);
+
+    /*
+     * The same request from two srcids of one request_hash bucket, and
+     * two requests from one srcid. Each is routed before the next.
+     */
+    int c1 = unix_connect();
+    int c2 = unix_connect();
+    struct {
+        int fd;
+        uint16_t srcid;
+        const char *data;
+        struct srrp_packet *resp;
+    } reqs[] = {
+        { c1, 32, "{v:1}", NULL },
+        { c2, 32 + APIBUS_REQUEST_HASH_SIZE, "{v:1}", NULL },
+        { c1, 32, "{v:2}", NULL },
+    };
+    size_t nreqs = sizeof(reqs) / sizeof(reqs[0]);
+    for (size_t i = 0; i < nreqs; i++) {
+        struct srrp_packet *pac =
+            srrp_write_request(reqs[i].srcid, "/16/echo", reqs[i].data);
+        assert_true(send(reqs[i].fd, pac->raw, pac->len, 0) == pac->len);
+        assert_true(recv_until(bus, stt, buf, sizeof(buf), pac->len) == pac->len);
+        uint16_t crc = crc16(pac->header, pac->header_len);
+        crc = crc16_crc(crc, pac->data, pac->data_len);
+        char data[32];
+        snprintf(data, sizeof(data), "{r:%d}", (int)i);
+        reqs[i].resp = srrp_write_response(reqs[i].srcid, crc, "/16/echo", data);
+        srrp_free(pac);
+    }
+    // answered out of order, each response reaches the fd of its request
+    int order[] = { 0, 2, 1 };
+    for (size_t i = 0; i < nreqs; i++) {
+        struct srrp_packet *resp = reqs[order[i]].resp;
+        assert_true(send(stt, resp->raw, resp->len, 0) == resp->len);
+        memset(buf, 0, sizeof(buf));
+        assert_true(recv_until(bus, reqs[order[i]].fd, buf, sizeof(buf),
+                               resp->len) == resp->len);
+        assert_true(memcmp(buf, resp->raw, resp->len) == 0);
+    }
+
+    // a repeated response finds no request left
+    struct srrp_packet *resp = reqs[1].resp;
+    assert_true(send(stt, resp->raw, resp->len, 0) == resp->len);
+    assert_true(recv_until(bus, c2, buf, sizeof(buf), 1) == 0);
+
+    for (size_t i = 0; i < nreqs; i++)
+        srrp_free(reqs[i].resp);
+    close(c1);
+    close(c2);
+    close(stt);
+    apibus_close(bus, fd);
+    apibus_disable_posix(bus);
+    apibus_destroy(bus);
+}
+
+static int udp_connect(void)
+{
+    int fd = socket(PF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = PF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(1226);
+    assert_true(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    return fd;
+}
+
+static void test_api_eof(void **status)
+{
+    struct apibus *bus = apibus_new();
+    apibus_enable_posix(bus);
+    int fd = apibus_open_unix(bus, UNIX_ADDR);
+
+    char buf[256] = {0};
+    int sub = unix_connect();
+    struct srrp_packet *pac = srrp_write_subscribe("/eof", "{}");
+    assert_true(send(sub, pac->raw, pac->len, 0) == pac->len);
+    srrp_free(pac);
+    assert_true(recv_until(bus, sub, buf, sizeof(buf), 6) == 6);
+
+    // a peer that closes mid-packet, what it sent in full still counts
+    int pub = unix_connect();
+    apibus_poll_timeout(bus, 10);
+    int fds[2];
+    assert_true(accepted_fds(bus, fd, fds, 2) == 2);
+    pac = srrp_write_publish("/eof", "{v:1}");
+    assert_true(send(pub, pac->raw, pac->len, 0) == pac->len);
+    const char *cut = "@0,$,0100:/eof?{";
+    assert_true(send(pub, cut, strlen(cut), 0) == (int)strlen(cut));
+    close(pub);
+
+    // handled and closed within a poll, not after PARSE_PACKET_TIMEOUT
+    for (int i = 0; i < 5 && accepted_fds(bus, fd, fds, 2) != 1; i++)
+        apibus_poll_timeout(bus, 10);
+    assert_true(accepted_fds(bus, fd, fds, 2) == 1);
+    memset(buf, 0, sizeof(buf));
+    assert_true(recv(sub, buf, sizeof(buf), MSG_DONTWAIT) == pac->len);
+    assert_true(memcmp(buf, pac->raw, pac->len) == 0);
+    srrp_free(pac);
+
+    close(sub);
+    apibus_close(bus, fd);
+    apibus_disable_posix(bus);
+    apibus_destroy(bus);
+}
+
+static void test_api_udp(void **status)
+{
+    struct apibus *bus = apibus_new();
+    apibus_enable_posix(bus);
+    int next = dup(0);
+    close(next);
+    assert_true(apibus_open_udp(bus, "127.0.0.1") == -1);
+    assert_true(apibus_open_tcp(bus, "127.0.0.1") == -1);
+    assert_true(dup(0) == next);
+    close(next);
+
+    int fd = apibus_open_udp(bus, UDP_ADDR);
+    assert_true(fd >= 0);
+
+    int sub = udp_connect();
+    int pub = udp_connect();
+    char buf[256] = {0};
+
+    struct srrp_packet *pac = srrp_write_subscribe("/udp/metric", "{}");
+    assert_true(send(sub, pac->raw, pac->len, 0) == pac->len);
+    srrp_free(pac);
+    assert_true(recv_until(bus, sub, buf, sizeof(buf), 6) == 6);
+    assert_true(memcmp(buf, "Sub OK", 6) == 0);
+
+    // each datagram is a packet, read and sent back in batches
+    struct apibus_stats stats;
+    apibus_get_stats(bus, &stats);
+    uint64_t packets = stats.tx_packets;
+    uint64_t syscalls = stats.tx_syscalls;
+
+    pac = srrp_write_publish("/udp/metric", "{v:1}");
+    for (int i = 0; i < 100; i++)
+        assert_true(send(pub, pac->raw, pac->len, 0) == pac->len);
+
+    int n = 0;
+    for (int i = 0; i < 100 && n < 100; i++) {
+        apibus_poll_timeout(bus, 10);
+        int nr;
+        while ((nr = recv(sub, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+            assert_true(nr == pac->len);
+            assert_true(memcmp(buf, pac->raw, pac->len) == 0);
+            n++;
+        }
+    }
+    assert_true(n == 100);
+    srrp_free(pac);
+
+    apibus_get_stats(bus, &stats);
+    assert_true(stats.tx_packets - packets == 100);
+    assert_true(stats.tx_syscalls - syscalls < 100 / 4);
+    assert_true(stats.subscribers.used == 1);
+
+    // a datagram that is not one whole packet is dropped on its own
+    const char *cut = "@0,$,0100:/a?{";
+    assert_true(send(pub, cut, strlen(cut), 0) == (int)strlen(cut));
+    pac = srrp_write_publish("/udp/metric", "{v:2}");
+    assert_true(send(pub, pac->raw, pac->len, 0) == pac->len);
+    // at once, not after PARSE_PACKET_TIMEOUT gave up on the cut one
+    memset(buf, 0, sizeof(buf));
+    int nr = 0;
+    for (int i = 0; i < 5 && nr <= 0; i++) {
+        apibus_poll_timeout(bus, 10);
+        nr = recv(sub, buf, sizeof(buf), MSG_DONTWAIT);
+    }
+    assert_true(nr == pac->len);
+    assert_true(memcmp(buf, pac->raw, pac->len) == 0);
+    srrp_free(pac);
+
+    // the peers are virtual fds the bus closes like any other
+    int peers[2];
+    assert_true(accepted_fds(bus, fd, peers, 2) == 2);
+    assert_true(peers[0] < -1 && peers[1] < -1);
+    assert_true(apibus_close(bus, peers[0]) == 0);
+    apibus_get_stats(bus, &stats);
+    assert_true(stats.subscribers.used == 0);
+    assert_true(apibus_close(bus, peers[0]) == -1);
+
+    close(sub);
+    close(pub);
     apibus_close(bus, fd);
+    assert_true(apibus_close(bus, peers[1]) == -1);
     apibus_disable_posix(bus);
     apibus_destroy(bus);
 }
@@ -243,7 +1193,21 @@ int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_api_request_response),
+        cmocka_unit_test(test_api_sinkfd_hash),
+        cmocka_unit_test(test_api_station_expire),
+        cmocka_unit_test(test_api_request_match),
         cmocka_unit_test(test_api_subscribe_publish),
+        cmocka_unit_test(test_api_poll_timeout),
+        cmocka_unit_test(test_api_send_queue),
+        cmocka_unit_test(test_api_topic_wildcard),
+        cmocka_unit_test(test_api_topic_fanout),
+        cmocka_unit_test(test_api_topic_cache),
+        cmocka_unit_test(test_api_topic_ack),
+        cmocka_unit_test(test_api_topic_stream),
+        cmocka_unit_test(test_api_binary_framing),
+        cmocka_unit_test(test_api_rx_grow),
+        cmocka_unit_test(test_api_eof),
+        cmocka_unit_test(test_api_udp),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
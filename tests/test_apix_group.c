@@ -0,0 +1,216 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "apix.h"
+#include "apix-posix.h"
+#include "posix/apix-group.h"
+#include "srrp.h"
+#include "crc16.h"
+
+#define UNIX_ADDR "test_apisink_group"
+#define TCP_ADDR "127.0.0.1:1225"
+#define TCP_PORT 1225
+#define NR_SHARDS 2
+
+static int unix_connect(void)
+{
+    int fd = socket(PF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {0};
+    addr.sun_family = PF_UNIX;
+    strcpy(addr.sun_path, UNIX_ADDR);
+    assert_true(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+
+    struct timeval tv = { 3, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+// the shards run in their own threads, recv blocks up to the timeout
+static struct srrp_packet *recv_packet(int fd)
+{
+    static char buf[1024];
+    int nr = recv(fd, buf, sizeof(buf) - 1, 0);
+    if (nr <= 0)
+        return NULL;
+    buf[nr] = 0;
+    return srrp_read_one_packet(buf);
+}
+
+static void send_packet(int fd, struct srrp_packet *pac)
+{
+    assert_true(send(fd, pac->raw, pac->len, 0) == pac->len);
+    srrp_free(pac);
+}
+
+static void test_api_group(void **status)
+{
+    struct apibus_group *group = apibus_group_new(NR_SHARDS);
+    assert_true(apibus_group_size(group) == NR_SHARDS);
+    assert_true(apibus_group_shard(group, NR_SHARDS) == NULL);
+    for (int i = 0; i < NR_SHARDS; i++)
+        apibus_enable_posix(apibus_group_shard(group, i));
+    struct apibus *bus = apibus_group_shard(group, 0);
+    int fd = apibus_open_unix(bus, UNIX_ADDR);
+    assert_true(fd != -1);
+    assert_true(apibus_group_start(group) == 0);
+
+    // fds are spread in turn, srv and sub on one shard, cli and pub on the other
+    int srv = unix_connect();
+    int cli = unix_connect();
+    int sub = unix_connect();
+    int pub = unix_connect();
+
+    // the station is attached once its own request comes back to it
+    send_packet(srv, srrp_write_request(8888, "/8888/online", "{}"));
+    struct srrp_packet *pac = recv_packet(srv);
+    assert_true(pac && pac->leader == SRRP_REQUEST_LEADER);
+    srrp_free(pac);
+
+    send_packet(cli, srrp_write_request(3333, "/8888/hello", "{}"));
+    struct srrp_packet *req = recv_packet(srv);
+    assert_true(req && req->srcid == 3333);
+    uint16_t crc = crc16(req->header, req->header_len);
+    crc = crc16_crc(crc, req->data, req->data_len);
+    send_packet(srv, srrp_write_response(
+                    req->srcid, crc, req->header, "{msg:'world'}"));
+    srrp_free(req);
+
+    struct srrp_packet *resp = recv_packet(cli);
+    assert_true(resp && resp->leader == SRRP_RESPONSE_LEADER);
+    assert_true(strcmp(resp->data, "{msg:'world'}") == 0);
+    srrp_free(resp);
+
+    char buf[64] = {0};
+    send_packet(sub, srrp_write_subscribe("/group/topic", "{}"));
+    assert_true(recv(sub, buf, sizeof(buf), 0) == 6);
+    assert_true(memcmp(buf, "Sub OK", 6) == 0);
+
+    send_packet(pub, srrp_write_publish("/group/topic", "{v:1}"));
+    struct srrp_packet *msg = recv_packet(sub);
+    assert_true(msg && msg->leader == SRRP_PUBLISH_LEADER);
+    assert_true(strcmp(msg->data, "{v:1}") == 0);
+    srrp_free(msg);
+
+    // the idle shards are woken to stop, not left to their poll timeout
+    usleep(20 * 1000);
+    struct timeval ts_stop, ts_done;
+    gettimeofday(&ts_stop, NULL);
+    apibus_group_stop(group);
+    gettimeofday(&ts_done, NULL);
+    long stop_ms = (ts_done.tv_sec - ts_stop.tv_sec) * 1000 +
+        (ts_done.tv_usec - ts_stop.tv_usec) / 1000;
+    assert_true(stop_ms < APIBUS_GROUP_POLL_TIMEOUT / 2);
+
+    // 2 fds, a request, its response and a publish crossed the shards
+    uint64_t handoffs = 0;
+    for (int i = 0; i < NR_SHARDS; i++) {
+        struct apibus_stats stats;
+        apibus_get_stats(apibus_group_shard(group, i), &stats);
+        handoffs += stats.handoffs;
+        assert_true(stats.handoff_drops == 0);
+    }
+    assert_true(handoffs == 5);
+
+    close(srv);
+    close(cli);
+    close(sub);
+    close(pub);
+    apibus_close(bus, fd);
+    for (int i = 0; i < NR_SHARDS; i++)
+        apibus_disable_posix(apibus_group_shard(group, i));
+    apibus_group_destroy(group);
+}
+
+static int tcp_connect(void)
+{
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = PF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(TCP_PORT);
+    assert_true(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+
+    struct timeval tv = { 3, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+static void test_api_group_reuseport(void **status)
+{
+    struct apibus_group *group = apibus_group_new(NR_SHARDS);
+    for (int i = 0; i < NR_SHARDS; i++)
+        apibus_enable_posix(apibus_group_shard(group, i));
+    int fds[NR_SHARDS];
+    assert_true(apibus_group_open_tcp(group, TCP_ADDR, 16, fds) == 0);
+    for (int i = 0; i < NR_SHARDS; i++) {
+        struct apibus *bus = apibus_group_shard(group, i);
+        assert_true(fds[i] != -1);
+        assert_true(apibus_ioctl(bus, fds[i], APISINK_IOCTL_BACKLOG, 64) == 0);
+    }
+    assert_true(apibus_group_start(group) == 0);
+
+    // each listener accepts its own, every fd is served where it landed
+    int cfds[8];
+    for (int i = 0; i < 8; i++) {
+        cfds[i] = tcp_connect();
+        send_packet(cfds[i], srrp_write_request(100 + i, "/9999/none", "{}"));
+    }
+    for (int i = 0; i < 8; i++) {
+        char buf[64] = {0};
+        assert_true(recv(cfds[i], buf, sizeof(buf), 0) == 17);
+        assert_true(memcmp(buf, "STATION NOT FOUND", 17) == 0);
+        close(cfds[i]);
+    }
+
+    apibus_group_stop(group);
+
+    for (int i = 0; i < NR_SHARDS; i++) {
+        struct apibus *bus = apibus_group_shard(group, i);
+        struct apibus_stats stats;
+        apibus_get_stats(bus, &stats);
+        assert_true(stats.handoffs == 0);
+        apibus_close(bus, fds[i]);
+        apibus_disable_posix(bus);
+    }
+    apibus_group_destroy(group);
+}
+
+static void test_api_group_new_fail(void **status)
+{
+    // room for the wake pipe of the first shard only
+    struct rlimit rl, low;
+    assert_true(getrlimit(RLIMIT_NOFILE, &rl) == 0);
+    int next = dup(0);
+    close(next);
+    low = rl;
+    low.rlim_cur = next + 3;
+    assert_true(setrlimit(RLIMIT_NOFILE, &low) == 0);
+
+    struct apibus_group *group = apibus_group_new(4);
+    assert_true(setrlimit(RLIMIT_NOFILE, &rl) == 0);
+    assert_true(group == NULL);
+
+    // the fds of the shards already made are given back
+    int after = dup(0);
+    close(after);
+    assert_true(after == next);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_api_group),
+        cmocka_unit_test(test_api_group_reuseport),
+        cmocka_unit_test(test_api_group_new_fail),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
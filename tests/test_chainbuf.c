@@ -0,0 +1,68 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+#include "chainbuf.h"
+
+static void test_chainbuf(void **status)
+{
+    chainbuf_t *buf = chainbuf_new(64);
+    char msg[1024];
+    char pattern[1024];
+    for (size_t i = 0; i < sizeof(pattern); i++)
+        pattern[i] = 'a' + i % 26;
+
+    assert_true(chainbuf_used(buf) == 0);
+    assert_true(chainbuf_nblocks(buf) == 0);
+
+    // a write larger than a block spans several ones
+    assert_true(chainbuf_write(buf, pattern, 200) == 200);
+    assert_true(chainbuf_used(buf) == 200);
+    assert_true(chainbuf_nblocks(buf) == 4);
+
+    struct chainbuf_vec vec[8];
+    assert_true(chainbuf_read_vec(buf, vec, 8) == 4);
+    assert_true(vec[0].len == 64 && vec[3].len == 8);
+    assert_true(chainbuf_read_vec(buf, vec, 2) == 2);
+
+    // reads release the blocks they drain, the rest stays in place
+    char *second = vec[1].base;
+    assert_true(chainbuf_read(buf, msg, 100) == 100);
+    assert_true(memcmp(msg, pattern, 100) == 0);
+    assert_true(chainbuf_nblocks(buf) == 3);
+    assert_true(chainbuf_read_vec(buf, vec, 8) == 3);
+    assert_true(vec[0].base == second + 36);
+    assert_true(vec[0].len == 28);
+
+    assert_true(chainbuf_peek(buf, msg, sizeof(msg)) == 100);
+    assert_true(memcmp(msg, pattern + 100, 100) == 0);
+    assert_true(chainbuf_read_advance(buf, sizeof(msg)) == 100);
+    assert_true(chainbuf_used(buf) == 0);
+    assert_true(chainbuf_nblocks(buf) == 1);
+
+    // room reserved by write_vec is committed by write_advance
+    int cnt = chainbuf_write_vec(buf, 150, vec, 8);
+    assert_true(cnt == 3);
+    size_t total = 0;
+    for (int i = 0; i < cnt; i++) {
+        memcpy(vec[i].base, pattern + total, vec[i].len);
+        total += vec[i].len;
+    }
+    assert_true(total == 150);
+    assert_true(chainbuf_write_advance(buf, 120) == 120);
+    assert_true(chainbuf_used(buf) == 120);
+    assert_true(chainbuf_write(buf, pattern + 120, 30) == 30);
+    assert_true(chainbuf_read(buf, msg, sizeof(msg)) == 150);
+    assert_true(memcmp(msg, pattern, 150) == 0);
+
+    chainbuf_delete(buf);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_chainbuf),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
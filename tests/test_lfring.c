@@ -0,0 +1,161 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "lfring.h"
+
+#define NR_ITEMS 200000
+#define NR_PRODUCERS 4
+
+static void test_spsc_ring(void **status)
+{
+    spsc_ring_t *ring = spsc_ring_new(100);
+    assert_true(spsc_ring_size(ring) == 128);
+    assert_true(spsc_ring_spare(ring) == 128);
+
+    char msg[100];
+    for (size_t i = 0; i < sizeof(msg); i++)
+        msg[i] = (char)i;
+    assert_true(spsc_ring_write(ring, msg, sizeof(msg)) == sizeof(msg));
+    assert_true(spsc_ring_used(ring) == sizeof(msg));
+
+    char out[100] = {0};
+    assert_true(spsc_ring_read(ring, out, 60) == 60);
+    assert_true(memcmp(out, msg, 60) == 0);
+
+    // wraps across the end, the whole ring is usable
+    assert_true(spsc_ring_write(ring, msg, sizeof(msg)) == 88);
+    assert_true(spsc_ring_spare(ring) == 0);
+    assert_true(spsc_ring_write(ring, msg, 1) == 0);
+
+    assert_true(spsc_ring_peek(ring, out, 40) == 40);
+    assert_true(memcmp(out, msg + 60, 40) == 0);
+    assert_true(spsc_ring_read(ring, out, 40) == 40);
+    assert_true(spsc_ring_read(ring, out, sizeof(out)) == 88);
+    assert_true(memcmp(out, msg, 88) == 0);
+    assert_true(spsc_ring_used(ring) == 0);
+
+    spsc_ring_delete(ring);
+}
+
+static void *spsc_producer(void *arg)
+{
+    spsc_ring_t *ring = arg;
+    for (uint32_t i = 0; i < NR_ITEMS;) {
+        if (spsc_ring_spare(ring) >= sizeof(i)) {
+            spsc_ring_write(ring, &i, sizeof(i));
+            i++;
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void test_spsc_ring_threads(void **status)
+{
+    spsc_ring_t *ring = spsc_ring_new(256);
+    pthread_t pid;
+    pthread_create(&pid, NULL, spsc_producer, ring);
+
+    for (uint32_t i = 0; i < NR_ITEMS;) {
+        uint32_t value;
+        if (spsc_ring_used(ring) >= sizeof(value)) {
+            spsc_ring_read(ring, &value, sizeof(value));
+            assert_true(value == i);
+            i++;
+        } else {
+            sched_yield();
+        }
+    }
+
+    pthread_join(pid, NULL);
+    assert_true(spsc_ring_used(ring) == 0);
+    spsc_ring_delete(ring);
+}
+
+static void test_mpsc_ring(void **status)
+{
+    mpsc_ring_t *ring = mpsc_ring_new(3);
+    assert_true(mpsc_ring_size(ring) == 4);
+
+    void *data;
+    assert_true(mpsc_ring_pop(ring, &data) == -1);
+    for (intptr_t i = 0; i < 4; i++)
+        assert_true(mpsc_ring_push(ring, (void *)i) == 0);
+    assert_true(mpsc_ring_push(ring, (void *)4) == -1);
+    assert_true(mpsc_ring_used(ring) == 4);
+
+    for (intptr_t i = 0; i < 6; i++) {
+        assert_true(mpsc_ring_pop(ring, &data) == 0);
+        assert_true((intptr_t)data == i);
+        assert_true(mpsc_ring_push(ring, (void *)(i + 4)) == 0);
+    }
+    assert_true(mpsc_ring_used(ring) == 4);
+
+    mpsc_ring_delete(ring);
+}
+
+struct mpsc_producer_arg {
+    mpsc_ring_t *ring;
+    intptr_t id;
+};
+
+static void *mpsc_producer(void *arg)
+{
+    struct mpsc_producer_arg *p = arg;
+    for (intptr_t i = 0; i < NR_ITEMS / NR_PRODUCERS;) {
+        if (mpsc_ring_push(p->ring, (void *)(i * NR_PRODUCERS + p->id)) == 0)
+            i++;
+        else
+            sched_yield();
+    }
+    return NULL;
+}
+
+static void test_mpsc_ring_threads(void **status)
+{
+    mpsc_ring_t *ring = mpsc_ring_new(64);
+    pthread_t pids[NR_PRODUCERS];
+    struct mpsc_producer_arg args[NR_PRODUCERS];
+    for (int i = 0; i < NR_PRODUCERS; i++) {
+        args[i].ring = ring;
+        args[i].id = i;
+        pthread_create(&pids[i], NULL, mpsc_producer, &args[i]);
+    }
+
+    // each producer's items arrive in its own order
+    intptr_t next[NR_PRODUCERS] = {0};
+    for (int n = 0; n < NR_ITEMS / NR_PRODUCERS * NR_PRODUCERS;) {
+        void *data;
+        if (mpsc_ring_pop(ring, &data) == 0) {
+            intptr_t value = (intptr_t)data;
+            intptr_t id = value % NR_PRODUCERS;
+            assert_true(value / NR_PRODUCERS == next[id]);
+            next[id]++;
+            n++;
+        } else {
+            sched_yield();
+        }
+    }
+
+    for (int i = 0; i < NR_PRODUCERS; i++)
+        pthread_join(pids[i], NULL);
+    assert_true(mpsc_ring_used(ring) == 0);
+    mpsc_ring_delete(ring);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_spsc_ring),
+        cmocka_unit_test(test_spsc_ring_threads),
+        cmocka_unit_test(test_mpsc_ring),
+        cmocka_unit_test(test_mpsc_ring_threads),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
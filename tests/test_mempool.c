@@ -0,0 +1,57 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdint.h>
+#include <string.h>
+#include "mempool.h"
+
+struct obj {
+    uint64_t id;
+    char name[40];
+};
+
+static void test_mempool(void **status)
+{
+    mempool_t *pool = mempool_new(sizeof(struct obj), 4);
+    assert_true(mempool_used(pool) == 0);
+    assert_true(mempool_capacity(pool) == 0);
+
+    struct obj *objs[10];
+    for (int i = 0; i < 10; i++) {
+        objs[i] = mempool_alloc(pool);
+        assert_true(objs[i]);
+        assert_true(((uintptr_t)objs[i] & 7) == 0);
+        memset(objs[i], i, sizeof(struct obj));
+    }
+    assert_true(mempool_used(pool) == 10);
+    assert_true(mempool_peak(pool) == 10);
+    assert_true(mempool_capacity(pool) == 12);
+
+    for (int i = 0; i < 10; i++) {
+        for (size_t j = 0; j < sizeof(struct obj); j++)
+            assert_true(((unsigned char *)objs[i])[j] == i);
+    }
+
+    for (int i = 0; i < 6; i++)
+        mempool_free(pool, objs[i]);
+    assert_true(mempool_used(pool) == 4);
+    assert_true(mempool_peak(pool) == 10);
+
+    // freed objects are recycled before the pool grows
+    for (int i = 0; i < 8; i++)
+        objs[i] = mempool_alloc(pool);
+    assert_true(mempool_used(pool) == 12);
+    assert_true(mempool_peak(pool) == 12);
+    assert_true(mempool_capacity(pool) == 12);
+
+    mempool_delete(pool);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_mempool),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
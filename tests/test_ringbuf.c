@@ -54,10 +54,83 @@ static void test_ringbuf(void **status)
     ringbuf_delete(buf);
 }
 
+// a write never fills the ring, full and empty would look the same
+static void test_ringbuf_full(ringbuf_t *buf)
+{
+    size_t size = ringbuf_size(buf);
+    char msg[64];
+    memset(msg, 0x5a, sizeof(msg));
+
+    ringbuf_write(buf, msg, sizeof(msg));
+    ringbuf_read_advance(buf, sizeof(msg));
+    size_t total = 0, n = 1;
+    for (size_t i = 0; n && i < 2 * size / sizeof(msg); i++) {
+        n = ringbuf_write(buf, msg, sizeof(msg));
+        total += n;
+    }
+    assert_true(total == size - 1);
+    assert_true(ringbuf_used(buf) == size - 1);
+    assert_true(ringbuf_spare(buf) == 1);
+    assert_true(ringbuf_write_contig(buf) == 0);
+
+    ringbuf_read_advance(buf, size - 1);
+    assert_true(ringbuf_used(buf) == 0);
+    ringbuf_delete(buf);
+}
+
+static void test_ringbuf_keep_one(void **status)
+{
+    test_ringbuf_full(ringbuf_new(4096));
+#if defined __linux__
+    test_ringbuf_full(ringbuf_new_mirrored(4096));
+#endif
+}
+
+#if defined __linux__
+static void test_ringbuf_mirrored(void **status)
+{
+    ringbuf_t *buf = ringbuf_new_mirrored(100);
+    assert_true(buf != NULL);
+    assert_true(ringbuf_is_mirrored(buf));
+    size_t size = ringbuf_size(buf);
+    assert_true(size >= 100 && size % 4096 == 0);
+
+    // move the cursors near the end, the next write wraps across it
+    size_t skip = size - 100;
+    while (skip) {
+        size_t n = ringbuf_write_contig(buf);
+        if (n > skip)
+            n = skip;
+        ringbuf_write_advance(buf, n);
+        ringbuf_read_advance(buf, n);
+        skip -= n;
+    }
+    char msg[256];
+    for (size_t i = 0; i < sizeof(msg); i++)
+        msg[i] = (char)i;
+    assert_true(ringbuf_write(buf, msg, sizeof(msg)) == sizeof(msg));
+    assert_true(ringbuf_used(buf) == sizeof(msg));
+    assert_true(ringbuf_read_contig(buf) == sizeof(msg));
+    assert_true(memcmp(ringbuf_read_pos(buf), msg, sizeof(msg)) == 0);
+    assert_true(ringbuf_write_contig(buf) == ringbuf_spare(buf) - 1);
+
+    char out[256] = {0};
+    assert_true(ringbuf_read(buf, out, sizeof(out)) == sizeof(out));
+    assert_true(memcmp(out, msg, sizeof(msg)) == 0);
+    assert_true(ringbuf_used(buf) == 0);
+
+    ringbuf_delete(buf);
+}
+#endif
+
 int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_ringbuf),
+        cmocka_unit_test(test_ringbuf_keep_one),
+#if defined __linux__
+        cmocka_unit_test(test_ringbuf_mirrored),
+#endif
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
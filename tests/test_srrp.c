@@ -137,6 +137,381 @@ static void test_srrp_subscribe_publish(void **status)
     srrp_free(sub);
     srrp_free(unsub);
     srrp_free(pub);
+
+    pub = srrp_write_publish_seqno(0x1a2b, "/motor/speed", "{speed:12}");
+    pac = srrp_read_one_packet(pub->raw);
+    assert_true(pac);
+    assert_true(pac->len == strlen(pub->raw) + 1);
+    assert_true(pac->leader == '@');
+    assert_true(pac->seqno == 0x1a2b);
+    assert_true(strcmp(pac->data, "{speed:12}") == 0);
+    srrp_free(pac);
+    srrp_free(pub);
+
+    struct srrp_packet *ack = srrp_write_ack(0x1a, "/motor/speed");
+    pac = srrp_read_one_packet(ack->raw);
+    assert_true(pac);
+    assert_true(pac->len == strlen(ack->raw) + 1);
+    assert_true(pac->leader == '!');
+    assert_true(pac->seqno == 0x1a);
+    assert_true(memcmp(pac->header, "/motor/speed", pac->header_len) == 0);
+    srrp_free(pac);
+    srrp_free(ack);
+}
+
+static void test_srrp_parse(void **status)
+{
+    struct srrp_packet *req = srrp_write_request(
+        0x8888, "/8888/hello", "{name:'yon'}");
+    struct srrp_packet *pub = srrp_write_publish("/motor/speed", "{speed:12}");
+    struct srrp_packet *pac = NULL;
+    size_t consumed = 0;
+
+    // every truncated prefix is incomplete, never read beyond len
+    for (size_t i = 0; i < req->len; i++) {
+        char *part = malloc(i + 1);
+        memcpy(part, req->raw, i);
+        pac = srrp_parse(part, i, &consumed);
+        assert_true(pac == NULL);
+        assert_true(consumed == 0);
+        free(part);
+    }
+
+    // garbage, request, publish
+    size_t len = 5 + req->len + pub->len;
+    char *buf = malloc(len);
+    memcpy(buf, "xx?{}", 5);
+    memcpy(buf + 5, req->raw, req->len);
+    memcpy(buf + 5 + req->len, pub->raw, pub->len);
+
+    pac = srrp_parse(buf, len, &consumed);
+    assert_true(pac == NULL);
+    assert_true(consumed == 5);
+
+    pac = srrp_parse(buf + 5, len - 5, &consumed);
+    assert_true(pac);
+    assert_true(consumed == req->len);
+    assert_true(pac->leader == '>');
+    assert_true(pac->srcid == 0x8888);
+    assert_true(strcmp(pac->header, "/8888/hello") == 0);
+    assert_true(pac->data_len == strlen("{name:'yon'}"));
+    assert_true(memcmp(pac->data, "{name:'yon'}", pac->data_len) == 0);
+    srrp_free(pac);
+
+    pac = srrp_parse(buf + 5 + req->len, pub->len, &consumed);
+    assert_true(pac);
+    assert_true(consumed == pub->len);
+    assert_true(pac->leader == '@');
+    assert_true(strcmp(pac->header, "/motor/speed") == 0);
+    srrp_free(pac);
+
+    // a corrupted length is skipped up to the next leader
+    buf[5 + 6] = 'z';
+    pac = srrp_parse(buf + 5, len - 5, &consumed);
+    assert_true(pac == NULL);
+    assert_true(consumed == req->len);
+
+    free(buf);
+
+    // a text length beyond SRRP_LENGTH_MAX is refused, not waited for
+    len = 0x4e2e;
+    buf = malloc(len);
+    memset(buf, 'x', len);
+    memcpy(buf, "@0,$,4e2e:/a?{", 14);
+    buf[len - 2] = '}';
+    buf[len - 1] = 0;
+    pac = srrp_parse(buf, len, &consumed);
+    assert_true(pac == NULL);
+    assert_true(consumed != 0);
+    pac = srrp_parse(buf, 64, &consumed);
+    assert_true(pac == NULL);
+    assert_true(consumed != 0);
+    free(buf);
+
+    srrp_free(req);
+    srrp_free(pub);
+}
+
+struct stream_buf {
+    char *buf;
+    size_t len;
+    int npacs;
+};
+
+static int stream_emit(const char *raw, size_t len, void *arg)
+{
+    struct stream_buf *sb = arg;
+    sb->buf = realloc(sb->buf, sb->len + len);
+    memcpy(sb->buf + sb->len, raw, len);
+    sb->len += len;
+    sb->npacs++;
+    return 0;
+}
+
+static void test_srrp_stream(void **status)
+{
+    size_t data_len = 100 * 1024;
+    char *data = malloc(data_len + 1);
+    memset(data, 'x', data_len);
+    data[0] = '{';
+    data[data_len - 1] = '}';
+    data[data_len] = 0;
+
+    // a small message is a single packet, same as srrp_write_publish
+    struct stream_buf sb = {0};
+    struct srrp_packet *pub = srrp_write_publish("/motor/speed", "{speed:12}");
+    assert_true(srrp_write_stream(SRRP_PUBLISH_LEADER, 0, 0, "/motor/speed",
+                                  "{speed:12}", stream_emit, &sb) == 0);
+    assert_true(sb.npacs == 1);
+    assert_true(sb.len == pub->len);
+    assert_true(memcmp(sb.buf, pub->raw, pub->len) == 0);
+    srrp_free(pub);
+    free(sb.buf);
+
+    // a large one is cut into '^', '0'... and '$' fragments
+    memset(&sb, 0, sizeof(sb));
+    assert_true(srrp_write_stream(SRRP_PUBLISH_LEADER, 0, 0, "/motor/log",
+                                  data, stream_emit, &sb) == 0);
+    assert_true(sb.npacs > 1);
+
+    char *body = malloc(data_len + 64);
+    size_t body_len = 0;
+    size_t offset = 0;
+    for (int i = 0; i < sb.npacs; i++) {
+        struct srrp_view view;
+        size_t consumed = 0;
+        assert_true(srrp_parse_view(&view, sb.buf + offset,
+                                    sb.len - offset, &consumed) == 0);
+        assert_true(view.leader == SRRP_PUBLISH_LEADER);
+        assert_true(view.seqno == i);
+        if (i == 0)
+            assert_true(view.seat == SRRP_BEGIN_PACKET);
+        else if (i == sb.npacs - 1)
+            assert_true(view.seat == SRRP_END_PACKET);
+        else
+            assert_true(view.seat == SRRP_MID_PACKET);
+        const char *p = view.header ? view.header : view.data;
+        size_t n = view.data + view.data_len - p;
+        memcpy(body + body_len, p, n);
+        body_len += n;
+        offset += consumed;
+    }
+    assert_true(offset == sb.len);
+
+    struct srrp_view view = {0};
+    assert_true(srrp_parse_body(&view, body, body_len) == 0);
+    assert_true(view.header_len == strlen("/motor/log"));
+    assert_true(memcmp(view.header, "/motor/log", view.header_len) == 0);
+    assert_true(view.data_len == data_len);
+    assert_true(memcmp(view.data, data, data_len) == 0);
+
+    // the same stream in binary is cut at the same places
+    struct stream_buf bb = {0};
+    assert_true(srrp_write_stream_framing(
+                    SRRP_FRAMING_BINARY, SRRP_PUBLISH_LEADER, 0, 0,
+                    "/motor/log", data, stream_emit, &bb) == 0);
+    assert_true(bb.npacs == sb.npacs);
+    size_t text_offset = 0, bin_offset = 0;
+    for (int i = 0; i < bb.npacs; i++) {
+        struct srrp_view text, bin;
+        size_t consumed = 0;
+        assert_true(srrp_parse_view(&text, sb.buf + text_offset,
+                                    sb.len - text_offset, &consumed) == 0);
+        text_offset += consumed;
+        assert_true(srrp_parse_view(&bin, bb.buf + bin_offset,
+                                    bb.len - bin_offset, &consumed) == 0);
+        bin_offset += consumed;
+        assert_true(srrp_view_framing(&bin) == SRRP_FRAMING_BINARY);
+        assert_true(bin.seat == text.seat);
+        assert_true(bin.seqno == text.seqno);
+        assert_true(bin.header == NULL);
+        assert_true(bin.data_len == text.data_len);
+        assert_true(memcmp(bin.data, text.data, bin.data_len) == 0);
+    }
+    assert_true(bin_offset == bb.len);
+    free(bb.buf);
+
+    free(body);
+    free(sb.buf);
+    free(data);
+}
+
+static void test_srrp_binary(void **status)
+{
+    struct srrp_packet *resp = srrp_write_response(
+        0x8888, 0x1234, "/8888/hello", "{err:0}");
+    struct srrp_packet *bin = srrp_convert(resp, SRRP_FRAMING_BINARY);
+    assert_true(bin);
+    assert_true(bin->len < resp->len);
+    assert_true(bin->raw[0] == SRRP_BINARY_MARKER);
+
+    size_t consumed = 0;
+    struct srrp_packet *pac = srrp_parse(bin->raw, bin->len, &consumed);
+    assert_true(pac);
+    assert_true(consumed == bin->len);
+    assert_true(pac->leader == SRRP_RESPONSE_LEADER);
+    assert_true(pac->seat == SRRP_END_PACKET);
+    assert_true(pac->srcid == 0x8888);
+    assert_true(pac->reqcrc16 == 0x1234);
+    assert_true(strcmp(pac->header, "/8888/hello") == 0);
+    assert_true(strcmp(pac->data, "{err:0}") == 0);
+
+    // and back to the very same text packet
+    struct srrp_packet *text = srrp_convert(pac, SRRP_FRAMING_TEXT);
+    assert_true(text->len == resp->len);
+    assert_true(memcmp(text->raw, resp->raw, resp->len) == 0);
+    srrp_free(text);
+    srrp_free(pac);
+
+    // every truncated prefix is incomplete
+    for (size_t i = 0; i < bin->len; i++) {
+        assert_true(srrp_parse(bin->raw, i, &consumed) == NULL);
+        assert_true(consumed == 0);
+    }
+
+    // a text packet after a corrupted binary one is found again
+    size_t len = bin->len + resp->len;
+    char *buf = malloc(len);
+    memcpy(buf, bin->raw, bin->len);
+    memcpy(buf + bin->len, resp->raw, resp->len);
+    buf[14] ^= 1; // data_len
+    assert_true(srrp_parse(buf, len, &consumed) == NULL);
+    assert_true(consumed == bin->len);
+    pac = srrp_parse(buf + consumed, len - consumed, &consumed);
+    assert_true(pac);
+    assert_true(pac->leader == SRRP_RESPONSE_LEADER);
+    srrp_free(pac);
+    free(buf);
+
+    // nor a header and data the text framing would split elsewhere
+    char *header = bin->raw + SRRP_BINARY_HEADER_SIZE;
+    const char *bad[][2] = {
+        { "/8888?{ello", "{err:0}" },
+        { "/8888/hell?", "{err:0}" },
+        { "/8888/hello", "[err:0}" },
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        memcpy(header, bad[i][0], strlen(bad[i][0]));
+        memcpy(header + strlen(bad[i][0]), bad[i][1], strlen(bad[i][1]));
+        assert_true(srrp_parse(bin->raw, bin->len, &consumed) == NULL);
+        assert_true(consumed == bin->len);
+    }
+    memcpy(header, "/8888?hello{err:0}", 18);
+    pac = srrp_parse(bin->raw, bin->len, &consumed);
+    assert_true(pac);
+    assert_true(strcmp(pac->header, "/8888?hello") == 0);
+    srrp_free(pac);
+
+    srrp_free(bin);
+    srrp_free(resp);
+}
+
+static uint16_t crc16_bytewise(const char *buf, int len)
+{
+    uint16_t crc = 0;
+    for (int i = 0; i < len; i++) {
+        crc ^= (uint8_t)buf[i] << 8;
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+static void test_srrp_crc16(void **status)
+{
+    assert_true(crc16("123456789", 9) == 0x31c3);
+
+    // every length and alignment around the 8 byte slices
+    char buf[64];
+    for (size_t i = 0; i < sizeof(buf); i++)
+        buf[i] = rand();
+    for (int off = 0; off < 8; off++) {
+        for (int len = 0; len + off <= (int)sizeof(buf); len++) {
+            assert_true(crc16(buf + off, len) == crc16_bytewise(buf + off, len));
+            uint16_t crc = crc16(buf + off, len / 2);
+            assert_true(crc16_crc(crc, buf + off + len / 2, len - len / 2) ==
+                        crc16_bytewise(buf + off, len));
+        }
+    }
+
+    // the trailer is written when enabled and verified when present
+    assert_true(srrp_set_crc16(1) == 0);
+    struct srrp_packet *req = srrp_write_request(
+        0x8888, "/8888/hello", "{name:'yon'}");
+    struct srrp_packet *bin = srrp_convert(req, SRRP_FRAMING_BINARY);
+    assert_true(srrp_set_crc16(0) == 1);
+
+    assert_true(req->raw[req->len - 1] == 0);
+    assert_true(req->raw[req->len - 1 - SRRP_CRC16_TRAILER_LEN] == 0);
+    assert_true(strcmp(req->data, "{name:'yon'}") == 0);
+    assert_true(bin->raw[3] == SRRP_BINARY_FLAG_CRC16);
+
+    struct srrp_packet *pacs[] = { req, bin };
+    for (int i = 0; i < 2; i++) {
+        size_t consumed = 0;
+        struct srrp_packet *pac = srrp_parse(pacs[i]->raw, pacs[i]->len, &consumed);
+        assert_true(pac);
+        assert_true(consumed == pacs[i]->len);
+        assert_true(strcmp(pac->header, "/8888/hello") == 0);
+        assert_true(pac->data_len == strlen("{name:'yon'}"));
+        assert_true(strcmp(pac->data, "{name:'yon'}") == 0);
+        srrp_free(pac);
+
+        // a flipped bit in data is caught
+        ((char *)pacs[i]->data)[1] ^= 1;
+        assert_true(srrp_parse(pacs[i]->raw, pacs[i]->len, &consumed) == NULL);
+        assert_true(consumed != 0);
+        srrp_free(pacs[i]);
+    }
+
+    // or asked for by a single writer, the process wide setting is off
+    struct srrp_packet *pub = srrp_write_publish("/motor/speed", "{speed:12}");
+    struct srrp_packet *crc_pub = srrp_convert(
+        pub, SRRP_FRAMING_TEXT | SRRP_FRAMING_CRC16);
+    assert_true(crc_pub->len == pub->len + SRRP_CRC16_TRAILER_LEN);
+    assert_true(crc_pub->raw[crc_pub->len - 1 - SRRP_CRC16_TRAILER_LEN] == 0);
+    size_t consumed = 0;
+    struct srrp_packet *pac = srrp_parse(crc_pub->raw, crc_pub->len, &consumed);
+    assert_true(pac && consumed == crc_pub->len);
+    srrp_free(pac);
+    srrp_free(crc_pub);
+    crc_pub = srrp_convert(pub, SRRP_FRAMING_BINARY | SRRP_FRAMING_CRC16);
+    assert_true(crc_pub->raw[3] == SRRP_BINARY_FLAG_CRC16);
+    srrp_free(crc_pub);
+    srrp_free(pub);
+}
+
+static void test_srrp_resync(void **status)
+{
+    struct srrp_packet *pub = srrp_write_publish("/motor/speed", "{speed:12}");
+    struct srrp_packet *bin = srrp_convert(pub, SRRP_FRAMING_BINARY);
+    struct srrp_packet *pacs[] = { pub, bin };
+    char buf[256];
+
+    // noise of every length, with leaders not followed by a digit in it
+    for (int i = 0; i < 2; i++) {
+        for (size_t noise = 1; noise < 100; noise++) {
+            for (size_t j = 0; j < noise; j++)
+                buf[j] = j % 7 == 3 ? SRRP_PUBLISH_LEADER : 'a' + j % 26;
+            memcpy(buf + noise, pacs[i]->raw, pacs[i]->len);
+
+            size_t consumed = 0;
+            assert_true(srrp_parse(buf, noise + pacs[i]->len, &consumed) == NULL);
+            assert_true(consumed == noise);
+            struct srrp_packet *pac = srrp_parse(
+                buf + consumed, pacs[i]->len, &consumed);
+            assert_true(pac);
+            srrp_free(pac);
+        }
+    }
+
+    char noise[] = "xx@y>#@1,$";
+    assert_true(srrp_next_packet_offset(noise) == 6);
+    assert_true(srrp_next_packet_offset(pub->raw) == 0);
+    assert_true(srrp_next_packet_offset("no leader at all @") == -1);
+
+    srrp_free(bin);
+    srrp_free(pub);
 }
 
 int main(void)
@@ -144,6 +519,11 @@ int main(void)
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_srrp_request_reponse),
         cmocka_unit_test(test_srrp_subscribe_publish),
+        cmocka_unit_test(test_srrp_parse),
+        cmocka_unit_test(test_srrp_stream),
+        cmocka_unit_test(test_srrp_binary),
+        cmocka_unit_test(test_srrp_crc16),
+        cmocka_unit_test(test_srrp_resync),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }